@@ -0,0 +1,160 @@
+/* ------------------------------------------------------------------------
+   diskWorkload.c
+   College of Applied Science and Technology
+   The University of Arizona
+   CYBV 489
+
+   Workload generator for the disk service. Several processes keep a
+   window of random reads and writes in flight on one disk, then the
+   service statistics are reported so FIFO and C-LOOK can be compared.
+
+   ------------------------------------------------------------------------ */
+#include <Windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <THREADSLib.h>
+#include <Scheduler.h>
+#include <Messaging.h>
+#include <stdint.h>
+#include "message.h"
+
+/* Limits on the generated workload */
+#define DISK_WORKLOAD_MAX_PROCS     16
+#define DISK_WORKLOAD_WINDOW        8   /* requests each process keeps in flight */
+
+typedef struct
+{
+    int          unit;
+    int          requestCount;
+    unsigned int seed;
+} WorkloadArgs;
+
+static int disk_workload_process(void* arg);
+static unsigned int workload_random(unsigned int* pSeed);
+
+static WorkloadArgs workloadArgs[DISK_WORKLOAD_MAX_PROCS];
+
+
+/* ------------------------------------------------------------------------
+   Name - disk_workload_run
+   Purpose - Starts the disk service with the given policy, runs processCount
+             workload processes against it and prints the statistics.
+             The same seed produces the same request stream for each policy.
+   Parameters - disk unit, scheduling policy, number of processes, requests
+                per process, random seed.
+   Returns - total seek distance in tracks, -1 if invalid args or the
+             service could not be started.
+   ----------------------------------------------------------------------- */
+int disk_workload_run(int unit, int scheduling, int processCount, int requestsPerProcess, unsigned int seed)
+{
+    char processName[32];
+    int exitCode;
+    int childCount = 1; /* the disk driver */
+
+    if (processCount <= 0 || processCount > DISK_WORKLOAD_MAX_PROCS || requestsPerProcess <= 0)
+        return -1;
+    if (disk_service_start(unit, scheduling) < 0)
+        return -1;
+
+    for (int i = 0; i < processCount; ++i)
+    {
+        workloadArgs[i].unit = unit;
+        workloadArgs[i].requestCount = requestsPerProcess;
+        workloadArgs[i].seed = seed + i;
+        snprintf(processName, sizeof(processName), "DiskWorkload%d", i);
+        if (k_spawn(processName, disk_workload_process, &workloadArgs[i], THREADS_MIN_STACK_SIZE, 1) >= 0)
+        {
+            childCount++;
+        }
+    }
+
+    // Wait for the workload processes, then drain and stop the driver
+    for (int i = 0; i < childCount - 1; ++i)
+    {
+        k_wait(&exitCode);
+    }
+    disk_service_stop(unit);
+    k_wait(&exitCode);
+
+    DiskService* pService = disk_service_stats(unit);
+    console_output(FALSE, "disk%d %s: %d requests, %d transfers, %d replies dropped, %d tracks moved (%d.%02d per request)\n",
+                   unit, scheduling == DISK_SCHED_CLOOK ? "C-LOOK" : "FIFO",
+                   pService->requestsServed, pService->transfers, pService->repliesDropped, pService->tracksMoved,
+                   pService->tracksMoved / (pService->requestsServed ? pService->requestsServed : 1),
+                   pService->tracksMoved * 100 / (pService->requestsServed ? pService->requestsServed : 1) % 100);
+
+    return pService->tracksMoved;
+}
+
+/* ------------------------------------------------------------------------
+   Name - disk_workload_process
+   Purpose - Issues random requests in batches of DISK_WORKLOAD_WINDOW and
+             collects their completions. About one request in four reads or
+             writes the sector after the previous one, so merging is exercised.
+   Parameters - pointer to this process' WorkloadArgs.
+   Returns - 0, or -1 if it could not get a reply mailbox or buffers.
+   ----------------------------------------------------------------------- */
+static int disk_workload_process(void* arg)
+{
+    WorkloadArgs* pArgs = (WorkloadArgs*)arg;
+    unsigned int seed = pArgs->seed;
+    int requestCount = pArgs->requestCount;
+    DiskRequest request;
+    DiskReply reply;
+
+    int replyMbox = mailbox_create(DISK_WORKLOAD_WINDOW, sizeof(DiskReply));
+    unsigned char* pBuffers = malloc(DISK_WORKLOAD_WINDOW * DISK_SECTOR_SIZE);
+    if (replyMbox < 0 || pBuffers == NULL)
+    {
+        free(pBuffers);
+        k_exit(-1);
+        return -1;
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.replyMbox = replyMbox;
+    request.sectorCount = 1;
+
+    for (int issued = 0; issued < requestCount; )
+    {
+        int batch = 0;
+        for (; batch < DISK_WORKLOAD_WINDOW && issued < requestCount; ++batch, ++issued)
+        {
+            if (workload_random(&seed) % 4 != 0 || request.firstSector + 1 >= DISK_SECTORS_PER_TRACK)
+            {
+                request.track = workload_random(&seed) % DISK_TRACK_COUNT;
+                request.firstSector = workload_random(&seed) % DISK_SECTORS_PER_TRACK;
+                request.operation = workload_random(&seed) % 2 ? DISK_REQUEST_WRITE : DISK_REQUEST_READ;
+            }
+            else
+            {
+                request.firstSector++;
+            }
+            request.pBuffer = pBuffers + batch * DISK_SECTOR_SIZE;
+            request.requestId = issued;
+            if (disk_request_async(pArgs->unit, &request) < 0)
+            {
+                // Service went away, collect what is outstanding and stop
+                requestCount = issued;
+                break;
+            }
+        }
+        for (int i = 0; i < batch; ++i)
+        {
+            disk_request_wait(replyMbox, &reply);
+        }
+    }
+
+    mailbox_free(replyMbox);
+    free(pBuffers);
+    k_exit(0);
+    return 0;
+}
+
+/* Small LCG so a seed always gives the same request stream */
+static unsigned int workload_random(unsigned int* pSeed)
+{
+    *pSeed = *pSeed * 1103515245u + 12345u;
+    return (*pSeed >> 16) & 0x7fff;
+}
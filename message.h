@@ -12,6 +12,26 @@ typedef enum {MBSTATUS_EMPTY=0, MBSTATUS_INUSE, MBSTATUS_RELEASED, MBSTATUS_MAX}
 #define BLOCKED_RECEIVE 11
 #define BLOCKED_SEND    12
 #define BLOCKED_RELEASE 13
+#define BLOCKED_CALL    14
+
+/* Device table layout: disk0, disk1, then term0..term3 */
+#define DISK_COUNT              2
+#define TERMINAL_COUNT          4
+#define FIRST_TERMINAL_INDEX    DISK_COUNT
+
+/* Size of each terminal's receive and transmit ring (bytes) */
+#define TERM_RING_SIZE  256
+
+/* The terminal hardware interface comes from THREADSLib (or the build):
+ *   TERM_STATUS_CHAR(status)        character in a receive interrupt's status
+ *   TERM_STATUS_RECV_READY(status)  status reports a received character
+ *   TERM_STATUS_XMIT_READY(status)  status reports the transmitter is free
+ *   TERM_TRANSMIT(deviceName, ch)   writes one byte to the transmit register
+ * There is no safe guess for these, so a missing one stops the build. */
+#if !defined(TERM_STATUS_CHAR) || !defined(TERM_STATUS_RECV_READY) || \
+    !defined(TERM_STATUS_XMIT_READY) || !defined(TERM_TRANSMIT)
+#error "THREADSLib must define TERM_STATUS_CHAR, TERM_STATUS_RECV_READY, TERM_STATUS_XMIT_READY and TERM_TRANSMIT"
+#endif
 
 typedef struct mail_slot 
 {
@@ -20,6 +40,9 @@ typedef struct mail_slot
    int       mbox_id;
    unsigned char message[MAX_MESSAGE];
    int       messageSize;
+   int       callerPid;   /* pid waiting in mailbox_call for the reply, 0 for plain sends */
+   int       callSequence; /* identifies that call, a reply must quote it */
+   int*      pSendStatus; /* parked sender's status: set to 1 when delivered, -1 when released */
    /* other items as needed... */
 
 } MailSlot;
@@ -46,6 +69,10 @@ struct mailbox
    int           blockedReceiverHead;
    int           blockedReceiverTail;
    int           releaseBlockedReceivers; /* Set to 1 by mailbox_free to signal all blocked receivers */
+   int           releasingCount; /* Released waiters that have not yet left the mailbox */
+   int           releaserPid; /* Process blocked in mailbox_free until they have */
+   SlotPtr       pWaitingSlotListHead; /* Messages of blocked senders, in arrival order */
+   int           pendingReceivers; /* Woken receivers with a message reserved for them */
    /* other items as needed... */
    MAILBOX_TYPE      type;
    MAILBOX_STATUS    status;
@@ -53,5 +80,119 @@ struct mailbox
    int               slotCount;
 };
 
+/* Disk service request operations */
+#define DISK_REQUEST_READ       0
+#define DISK_REQUEST_WRITE      1
+#define DISK_REQUEST_SHUTDOWN   2
+
+/* Disk service scheduling policies */
+#define DISK_SCHED_FIFO         0
+#define DISK_SCHED_CLOOK        1
+
+/* Requests the disk service holds for reordering, and the largest merged transfer */
+#define DISK_QUEUE_SIZE         64
+#define DISK_MAX_MERGE          8
+
+/* The disk geometry and transfer interface come from THREADSLib (or the build):
+ *   DISK_SECTOR_SIZE, DISK_SECTORS_PER_TRACK, DISK_TRACK_COUNT
+ *   DISK_START_TRANSFER(deviceName, operation, track, sector, count, pBuffer)
+ *       starts a DISK_REQUEST_READ/WRITE, returns < 0 if the device refused it;
+ *       the completion arrives as an I/O interrupt
+ * Each one is checked on its own so a partial definition stops the build. */
+#ifndef DISK_SECTOR_SIZE
+#error "THREADSLib must define DISK_SECTOR_SIZE"
+#endif
+#ifndef DISK_SECTORS_PER_TRACK
+#error "THREADSLib must define DISK_SECTORS_PER_TRACK"
+#endif
+#ifndef DISK_TRACK_COUNT
+#error "THREADSLib must define DISK_TRACK_COUNT"
+#endif
+#ifndef DISK_START_TRANSFER
+#error "THREADSLib must define DISK_START_TRANSFER"
+#endif
+
+/* Reply channel states */
+typedef enum {CALL_PENDING=0, CALL_BLOCKED, CALL_DONE, CALL_RELEASING, CALL_RELEASED} CALL_STATE;
+
+typedef struct call_channel
+{
+   struct call_channel* pNext;    /* next call in progress */
+   int           pid;             /* calling process */
+   int           sequence;        /* unique per call, quoted by mailbox_reply */
+   int           mboxId;          /* server mailbox the request went to */
+   CALL_STATE    state;
+   void*         pReplyBuffer;    /* the server's reply is copied straight here */
+   int           replyBufferSize;
+   int           replySize;
+} CallChannel;
+
+typedef struct term_ring
+{
+   unsigned char buffer[TERM_RING_SIZE];
+   int           head;        /* next byte to remove */
+   int           tail;        /* next free position */
+   int           count;       /* bytes currently buffered */
+   int           lineCount;   /* newlines currently buffered */
+   int           dropped;     /* bytes lost because the ring was full */
+} TermRing;
+
+typedef struct terminal_data
+{
+   TermRing      receiveRing;     /* filled by the I/O interrupt handler */
+   TermRing      transmitRing;    /* drained by the I/O interrupt handler */
+   int           transmitBusy;    /* a byte is in the transmit register */
+   int           transmitMbox;    /* wakeups for writers waiting on ring space */
+} TerminalData;
+
+typedef struct disk_request
+{
+   int           operation;       /* DISK_REQUEST_READ, _WRITE or _SHUTDOWN */
+   int           track;
+   int           firstSector;
+   int           sectorCount;
+   void*         pBuffer;         /* sectorCount * DISK_SECTOR_SIZE bytes */
+   int           replyMbox;       /* receives a DiskReply when the request completes */
+   int           requestId;       /* echoed back in the reply */
+} DiskRequest;
+
+typedef struct disk_reply
+{
+   int           requestId;
+   int           status;          /* device status, or -1 if the request was invalid */
+} DiskReply;
+
+typedef struct disk_service
+{
+   int           requestMbox;
+   int           driverPid;
+   int           stopping;        /* set once shutdown begins, new requests are refused */
+   int           scheduling;      /* DISK_SCHED_FIFO or DISK_SCHED_CLOOK */
+   int           currentTrack;    /* head position after the last transfer */
+   int           currentSector;
+   DiskRequest   pending[DISK_QUEUE_SIZE];
+   int           pendingCount;
+   unsigned char mergeBuffer[DISK_MAX_MERGE * DISK_SECTOR_SIZE];
+   /* statistics */
+   int           requestsServed;
+   int           transfers;       /* device operations issued, merged requests share one */
+   int           tracksMoved;     /* total seek distance */
+   int           repliesDropped;  /* completions that did not fit in the requester's reply mailbox */
+} DiskService;
+
+int disk_service_start(int unit, int scheduling);
+int disk_service_stop(int unit);
+int disk_request_async(int unit, DiskRequest* pRequest);
+int disk_request_wait(int replyMbox, DiskReply* pReply);
+DiskService* disk_service_stats(int unit);
+int disk_workload_run(int unit, int scheduling, int processCount, int requestsPerProcess, unsigned int seed);
+
+int mailbox_call(int mboxId, void* pRequest, int requestSize, void* pReply, int replySize);
+int mailbox_receive_call(int mboxId, void* pMsg, int msg_size, int* pCallerPid, int* pCallSequence);
+int mailbox_reply(int callerPid, int callSequence, void* pReply, int replySize);
+
+int term_read(int unit, void* pBuffer, int bufferSize, int lineMode);
+int term_write(int unit, void* pBuffer, int size);
+
 
 
@@ -0,0 +1,19 @@
+/* Stand-in for Messaging.h when building the stress harness on Linux.
+ * Limits match the course defaults and can be overridden with -D. */
+#pragma once
+
+#ifndef MAXMBOX
+#define MAXMBOX         2000
+#endif
+#ifndef MAXSLOTS
+#define MAXSLOTS        2500
+#endif
+#ifndef MAX_MESSAGE
+#define MAX_MESSAGE     150
+#endif
+
+int mailbox_create(int slots, int slot_size);
+int mailbox_send(int mboxId, void* pMsg, int msg_size, int wait);
+int mailbox_receive(int mboxId, void* pMsg, int msg_size, int wait);
+int mailbox_free(int mboxId);
+int wait_device(char* deviceName, int* status);
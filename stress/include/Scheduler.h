@@ -0,0 +1,2 @@
+/* Stand-in for Scheduler.h when building the stress harness on Linux. */
+#pragma once
@@ -0,0 +1,68 @@
+/* Stand-in for THREADSLib.h when building the stress harness on Linux.
+ * Only what the messaging code uses is declared; stressMessaging.c
+ * implements it on top of a deterministic simulated scheduler. */
+#pragma once
+#include <stdint.h>
+
+#define TRUE    1
+#define FALSE   0
+
+#define THREADS_MAX_SYSCALLS        50
+#define THREADS_MAX_DEVICES         8
+#define THREADS_CLOCK_DEVICE_ID     7
+#define THREADS_TIMER_INTERRUPT     0
+#define THREADS_IO_INTERRUPT        1
+#define THREADS_SYS_CALL_INTERRUPT  2
+#define THREADS_MIN_STACK_SIZE      (32 * 1024)
+
+#define PSR_KERNEL_MODE     0x2
+
+#define DEVICE_DISK         1
+#define DEVICE_TERMINAL     2
+
+typedef struct
+{
+    int   call_id;
+    void* arguments[6];
+} system_call_arguments_t;
+
+typedef void (*interrupt_handler_t)(char deviceId[32], uint8_t command, uint32_t status, void* pArgs);
+
+/* processes */
+int k_spawn(char* name, int (*entryPoint)(void*), void* arg, int stackSize, int priority);
+int k_wait(int* pExitCode);
+void k_exit(int exitCode);
+int k_getpid(void);
+int block(int blockStatus);
+int unblock(int pid);
+int signaled(void);
+
+/* machine */
+unsigned int get_psr(void);
+void disableInterrupts(void);
+void enableInterrupts(void);
+interrupt_handler_t* get_interrupt_handlers(void);
+extern int (*check_io)(void);
+void console_output(int debug, const char* format, ...);
+void stop(int exitCode);
+
+/* devices */
+int device_initialize(char* deviceName);
+uint32_t device_handle(char* deviceName);
+int device_output(char* deviceName, unsigned char ch);
+int disk_transfer(char* deviceName, int operation, int track, int sector, int count, void* pBuffer);
+
+/* Device interface message.h expects from THREADSLib, mapped onto the
+ * simulated devices in stressMessaging.c */
+#define SIM_TERM_RECV_READY             0x100
+#define SIM_TERM_XMIT_READY             0x200
+#define TERM_STATUS_CHAR(status)        ((unsigned char)((status) & 0xFF))
+#define TERM_STATUS_RECV_READY(status)  (((status) & SIM_TERM_RECV_READY) != 0)
+#define TERM_STATUS_XMIT_READY(status)  (((status) & SIM_TERM_XMIT_READY) != 0)
+#define TERM_TRANSMIT(deviceName, ch)   device_output((deviceName), (ch))
+
+#define DISK_SECTOR_SIZE        512
+#define DISK_SECTORS_PER_TRACK  16
+#define DISK_TRACK_COUNT        32
+#define DISK_START_TRANSFER(deviceName, operation, track, sector, count, pBuffer) \
+    disk_transfer((deviceName), (operation), (track), (sector), (count), (pBuffer))
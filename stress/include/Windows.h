@@ -0,0 +1,3 @@
+/* Stand-in for the Windows header when building the stress harness on Linux.
+ * The messaging code uses nothing from it. */
+#pragma once
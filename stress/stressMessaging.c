@@ -0,0 +1,1646 @@
+/* ------------------------------------------------------------------------
+   stressMessaging.c
+   College of Applied Science and Technology
+   The University of Arizona
+   CYBV 489
+
+   Linux stress harness for the messaging layer. THREADSLib is replaced by
+   a seedable simulated scheduler (ucontext processes, random choice among
+   ready processes) so thousands of processes can be driven through
+   send/receive/free and call/reply workloads and every run with the same
+   seed is the same. Simulated disks and terminals raise I/O interrupts
+   from a device process, so the terminal rings and the disk service run
+   against the real interrupt handler.
+
+   Build and run from the repository root:
+     gcc -O2 -Istress/include -Wno-int-conversion -o stressMessaging \
+         stress/stressMessaging.c testMessaging.c diskWorkload.c
+     ./stressMessaging [--seed N] [--max-procs N] [--messages N]
+
+   unblock() of a process that is not blocked is an invariant violation,
+   except for a process a signal has made ready that has not run yet: the
+   waker cannot see that, so the wakeup is refused and counted instead.
+
+   Exits with 1 if a FIFO, no-lost-message, wakeup or device invariant is
+   broken.
+   ------------------------------------------------------------------------ */
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <THREADSLib.h>
+#include <Messaging.h>
+#include "../message.h"
+
+#define SIM_MAX_PROCS       8192
+#define SIM_STACK_SIZE      (32 * 1024)
+#define HISTOGRAM_BUCKETS   16      /* power of two buckets: 0, 1, 2-3, 4-7, ... */
+#define SIM_BLOCKED_WAIT    100     /* block status of a process in k_wait */
+#define SIM_TERM_BYTES      8192    /* bytes pushed through each simulated terminal */
+#define SIM_ANY_STATUS      1       /* disk_collect accepts any completion status */
+
+typedef enum {PROC_FREE=0, PROC_READY, PROC_RUNNING, PROC_BLOCKED, PROC_EXITED} PROC_STATE;
+
+typedef struct
+{
+    int          pid;
+    PROC_STATE   state;
+    ucontext_t   context;
+    void*        pStack;
+    int          (*entryPoint)(void*);
+    void*        arg;
+    int          signaled;
+    int          signalWoken;   /* made ready by a signal and has not run since */
+    int          blockStatus;   /* status passed to the last block() */
+    long         blockedAt;     /* tick the process last blocked */
+    int          parentPid;     /* 0 for processes the harness spawned */
+    int          childCount;    /* children not yet collected by k_wait */
+    int          exitedCount;   /* of those, the ones that have exited */
+    int          lastExitCode;
+} SimProcess;
+
+typedef struct
+{
+    long         sends;
+    long         receives;
+    long         wakeups;       /* unblock() calls by other processes */
+    long         signalRaces;   /* unblock() of a process a signal had already woken */
+    long         blocks;
+    long         maxWait;       /* longest time a process stayed blocked, in ticks */
+    long         waitHistogram[HISTOGRAM_BUCKETS];
+    long         depthHistogram[HISTOGRAM_BUCKETS];    /* messages queued after each op */
+    long         waiterHistogram[HISTOGRAM_BUCKETS];   /* processes blocked on the mailbox after each op */
+    int          peakSlots;     /* most messages queued in all mailboxes at once */
+} SimStats;
+
+/* Message sent by the workloads, enough to check order and loss */
+typedef struct
+{
+    int          producer;
+    int          sequence;      /* per producer */
+    long         ticket;        /* per mailbox, taken right before the send */
+    unsigned int check;
+} StressMessage;
+
+/* Request and reply of the call/reply workload */
+typedef struct
+{
+    int          client;
+    int          call;          /* per client */
+    int          value;
+    int          replyMbox;     /* where the send/receive variant replies */
+} CallMessage;
+
+typedef struct
+{
+    long         completed;     /* replies that matched their request */
+    long         abandoned;     /* calls a signal interrupted */
+    long         staleReplies;  /* mailbox_reply calls refused for abandoned calls */
+    long         released;      /* calls that got -5 from mailbox_free */
+} CallStats;
+
+/* -------------------------- Globals ------------------------------------- */
+
+/* defined by the messaging code under test */
+extern MailBox mailboxes[MAXMBOX];
+
+int (*check_io)(void);
+
+static SimProcess processes[SIM_MAX_PROCS];
+static int readyList[SIM_MAX_PROCS];
+static int readyCount;
+static SimProcess* pCurrent;
+static ucontext_t schedulerContext;
+static unsigned long long rngState;
+static long tick;
+static SimStats stats;
+static int violations;
+static interrupt_handler_t interruptHandlers[4];
+
+/* workload bookkeeping */
+static long* mboxTickets;       /* next ticket per mailbox */
+static long* mboxLastTicket;    /* last ticket received per mailbox */
+static int* producerNext;       /* next sequence number expected per producer */
+static int* producerMbox;
+static int* consumerMbox;
+static int messagesPerProducer;
+static int consumerQuota;       /* messages each consumer receives */
+static long messagesSent;
+static long messagesReceived;
+static int freeResults[2];      /* [0] waiters that got -5, [1] other results */
+static int limitResults[2];     /* [0] waiters refused with -1, [1] other failures */
+static long limitNextTicket;
+static int callMbox;            /* server mailbox of the call/reply workload */
+static int callsPerClient;
+static int* callClientPids;
+static int callClientCount;
+static int callClientsDone;
+static CallStats callStats;
+
+/* simulated devices, in the order SchedulerEntryPoint puts them in devices[] */
+static const char* simDeviceNames[FIRST_TERMINAL_INDEX + TERMINAL_COUNT] =
+    {"disk0", "disk1", "term0", "term1", "term2", "term3"};
+static unsigned char termInput[TERMINAL_COUNT][SIM_TERM_BYTES];
+static unsigned char termOutput[TERMINAL_COUNT][SIM_TERM_BYTES];
+static int termTyped[TERMINAL_COUNT];          /* bytes raised as receive interrupts */
+static int termRead[TERMINAL_COUNT];           /* bytes returned by term_read */
+static int termOutputCount[TERMINAL_COUNT];
+static int termTransmitPending[TERMINAL_COUNT]; /* a byte is in the transmit register */
+static unsigned char diskImage[DISK_COUNT][DISK_TRACK_COUNT][DISK_SECTORS_PER_TRACK][DISK_SECTOR_SIZE];
+static int diskBusy[DISK_COUNT];
+static int diskFailTransfers;                  /* the next transfers the disks refuse */
+static int diskHoldCompletions;                /* the device process holds disk completions back */
+static int diskTestSeed;
+
+extern int SchedulerEntryPoint(void*);
+
+static void violation(const char* format, ...);
+static unsigned int sim_random(void);
+static void sim_yield(void);
+static void sim_signal(int pid);
+static int sim_run(void);
+static void record_op(int mboxId);
+static int bucket(long value);
+
+/* ------------------------- THREADSLib stand-in ------------------------- */
+
+static int sim_device_index(const char* deviceName);
+
+static void process_start(int pid)
+{
+    SimProcess* pProcess = &processes[pid - 1];
+    k_exit(pProcess->entryPoint(pProcess->arg));
+}
+
+int k_spawn(char* name, int (*entryPoint)(void*), void* arg, int stackSize, int priority)
+{
+    for (int i = 0; i < SIM_MAX_PROCS; ++i)
+    {
+        SimProcess* pProcess = &processes[i];
+        if (pProcess->state != PROC_FREE)
+            continue;
+
+        memset(pProcess, 0, sizeof(SimProcess));
+        pProcess->pid = i + 1;
+        pProcess->parentPid = pCurrent ? pCurrent->pid : 0;
+        if (pCurrent)
+            pCurrent->childCount++;
+        pProcess->entryPoint = entryPoint;
+        pProcess->arg = arg;
+        pProcess->pStack = malloc(SIM_STACK_SIZE);
+        if (pProcess->pStack == NULL)
+            return -1;
+        getcontext(&pProcess->context);
+        pProcess->context.uc_stack.ss_sp = pProcess->pStack;
+        pProcess->context.uc_stack.ss_size = SIM_STACK_SIZE;
+        pProcess->context.uc_link = NULL;
+        makecontext(&pProcess->context, (void (*)(void))process_start, 1, pProcess->pid);
+        pProcess->state = PROC_READY;
+        readyList[readyCount++] = pProcess->pid;
+        return pProcess->pid;
+    }
+    return -1;
+}
+
+int k_wait(int* pExitCode)
+{
+    if (pCurrent == NULL || pCurrent->childCount == 0)
+        return -1;
+    while (pCurrent->exitedCount == 0)
+        block(SIM_BLOCKED_WAIT);
+    pCurrent->exitedCount--;
+    pCurrent->childCount--;
+    *pExitCode = pCurrent->lastExitCode;
+    return 0;
+}
+
+void k_exit(int exitCode)
+{
+    if (pCurrent->parentPid > 0)
+    {
+        SimProcess* pParent = &processes[pCurrent->parentPid - 1];
+        pParent->exitedCount++;
+        pParent->lastExitCode = exitCode;
+        if (pParent->state == PROC_BLOCKED && pParent->blockStatus == SIM_BLOCKED_WAIT)
+            unblock(pParent->pid);
+    }
+    pCurrent->state = PROC_EXITED;
+    swapcontext(&pCurrent->context, &schedulerContext);
+}
+
+/* The harness itself runs as pid 0 between scenarios */
+int k_getpid(void)
+{
+    return pCurrent ? pCurrent->pid : 0;
+}
+
+int block(int blockStatus)
+{
+    pCurrent->state = PROC_BLOCKED;
+    pCurrent->blockStatus = blockStatus;
+    pCurrent->blockedAt = tick;
+    stats.blocks++;
+    swapcontext(&pCurrent->context, &schedulerContext);
+    return 0;
+}
+
+int unblock(int pid)
+{
+    // The one wakeup the caller cannot avoid: a signal readied the process
+    // and it has not run yet to take itself off the wait queue. The kernel
+    // refuses it; anything else aimed at a process that is not blocked is a bug.
+    if (pid > 0 && pid <= SIM_MAX_PROCS && processes[pid - 1].signalWoken)
+    {
+        stats.signalRaces++;
+        return -1;
+    }
+    if (pid <= 0 || pid > SIM_MAX_PROCS || processes[pid - 1].state != PROC_BLOCKED)
+    {
+        violation("unblock(%d) of a process that is not blocked", pid);
+        return -1;
+    }
+    SimProcess* pProcess = &processes[pid - 1];
+    long wait = tick - pProcess->blockedAt;
+    stats.wakeups++;
+    stats.waitHistogram[bucket(wait)]++;
+    if (wait > stats.maxWait)
+        stats.maxWait = wait;
+    pProcess->state = PROC_READY;
+    readyList[readyCount++] = pid;
+    return 0;
+}
+
+int signaled(void)
+{
+    return pCurrent ? pCurrent->signaled : 0;
+}
+
+/* Kernel mode with interrupts enabled */
+unsigned int get_psr(void)
+{
+    return PSR_KERNEL_MODE | 1;
+}
+
+void disableInterrupts(void)
+{
+}
+
+void enableInterrupts(void)
+{
+}
+
+interrupt_handler_t* get_interrupt_handlers(void)
+{
+    return interruptHandlers;
+}
+
+void console_output(int debug, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+void stop(int exitCode)
+{
+    exit(exitCode);
+}
+
+int device_initialize(char* deviceName)
+{
+    return sim_device_index(deviceName) >= 0 ? 0 : -1;
+}
+
+/* The handle is the device's index in devices[], as wait_device expects */
+uint32_t device_handle(char* deviceName)
+{
+    return (uint32_t)sim_device_index(deviceName);
+}
+
+/* Latches a byte in a terminal's transmit register, the device process
+ * raises the transmit-ready interrupt later */
+int device_output(char* deviceName, unsigned char ch)
+{
+    int unit = sim_device_index(deviceName) - FIRST_TERMINAL_INDEX;
+    if (unit < 0 || unit >= TERMINAL_COUNT)
+        return -1;
+    if (termTransmitPending[unit])
+        violation("term%d: byte written while the transmitter was busy", unit);
+    if (termOutputCount[unit] < SIM_TERM_BYTES)
+        termOutput[unit][termOutputCount[unit]++] = ch;
+    termTransmitPending[unit] = 1;
+    return 0;
+}
+
+/* Moves the data at once, the device process raises the completion later */
+int disk_transfer(char* deviceName, int operation, int track, int sector, int count, void* pBuffer)
+{
+    int unit = sim_device_index(deviceName);
+    if (unit < 0 || unit >= DISK_COUNT)
+        return -1;
+    if (diskFailTransfers > 0)
+    {
+        diskFailTransfers--;
+        return -1;
+    }
+    if (diskBusy[unit])
+        violation("disk%d: transfer started while the last one is in progress", unit);
+    if (track < 0 || track >= DISK_TRACK_COUNT || sector < 0 || count <= 0 ||
+        sector + count > DISK_SECTORS_PER_TRACK || count > DISK_MAX_MERGE)
+    {
+        violation("disk%d: transfer of %d sectors at %d/%d is out of range", unit, count, track, sector);
+        return -1;
+    }
+    if (operation == DISK_REQUEST_READ)
+        memcpy(pBuffer, diskImage[unit][track][sector], count * DISK_SECTOR_SIZE);
+    else
+        memcpy(diskImage[unit][track][sector], pBuffer, count * DISK_SECTOR_SIZE);
+    diskBusy[unit] = 1;
+    return 0;
+}
+
+static int sim_device_index(const char* deviceName)
+{
+    for (int i = 0; i < FIRST_TERMINAL_INDEX + TERMINAL_COUNT; ++i)
+    {
+        if (strcmp(simDeviceNames[i], deviceName) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Calls the registered I/O interrupt handler as the hardware would */
+static void sim_raise_io(int deviceIndex, uint32_t status)
+{
+    char deviceId[32];
+    snprintf(deviceId, sizeof(deviceId), "%s", simDeviceNames[deviceIndex]);
+    interruptHandlers[THREADS_IO_INTERRUPT](deviceId, 0, status, NULL);
+}
+
+int MessagingEntryPoint(void* arg)
+{
+    return 0;
+}
+
+/* ------------------------- Simulated scheduler ------------------------- */
+
+/* xorshift64*, seeded from the command line */
+static unsigned int sim_random(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (unsigned int)((rngState * 2685821657736338717ULL) >> 32);
+}
+
+/* Lets another ready process run, the caller stays ready */
+static void sim_yield(void)
+{
+    pCurrent->state = PROC_READY;
+    readyList[readyCount++] = pCurrent->pid;
+    swapcontext(&pCurrent->context, &schedulerContext);
+}
+
+/* Marks a process signaled and wakes it if it is blocked */
+static void sim_signal(int pid)
+{
+    SimProcess* pProcess = &processes[pid - 1];
+    pProcess->signaled = 1;
+    if (pProcess->state == PROC_BLOCKED)
+    {
+        pProcess->signalWoken = 1;
+        pProcess->state = PROC_READY;
+        readyList[readyCount++] = pid;
+    }
+}
+
+/* Lets a process continue after it has handled a signal */
+static void sim_clear_signal(void)
+{
+    pCurrent->signaled = 0;
+}
+
+/* Runs processes in random order until none are ready. Returns the number
+ * left blocked, which is a deadlock unless the scenario expects it. */
+static int sim_run(void)
+{
+    while (readyCount > 0)
+    {
+        int index = sim_random() % readyCount;
+        pCurrent = &processes[readyList[index] - 1];
+        readyList[index] = readyList[--readyCount];
+        pCurrent->state = PROC_RUNNING;
+        pCurrent->signalWoken = 0;
+        tick++;
+        swapcontext(&schedulerContext, &pCurrent->context);
+
+        if (pCurrent->state == PROC_EXITED)
+        {
+            free(pCurrent->pStack);
+            pCurrent->state = PROC_FREE;
+        }
+    }
+    pCurrent = NULL;
+
+    int stuck = 0;
+    for (int i = 0; i < SIM_MAX_PROCS; ++i)
+    {
+        if (processes[i].state == PROC_BLOCKED)
+            stuck++;
+    }
+    return stuck;
+}
+
+/* ------------------------- Statistics ---------------------------------- */
+
+static void violation(const char* format, ...)
+{
+    va_list args;
+    if (violations++ < 10)
+    {
+        printf("  VIOLATION: ");
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        printf("\n");
+    }
+}
+
+static int bucket(long value)
+{
+    int index = 0;
+    while (value > 0 && index < HISTOGRAM_BUCKETS - 1)
+    {
+        value >>= 1;
+        index++;
+    }
+    return index;
+}
+
+static int mailbox_depth(int mboxId)
+{
+    int depth = 0;
+    for (SlotPtr slot = mailboxes[mboxId].pSlotListHead; slot; slot = slot->pNextSlot)
+        depth++;
+    return depth;
+}
+
+/* Samples queue depth and waiters for the mailbox an operation just used */
+static void record_op(int mboxId)
+{
+    static int totalSlots;
+    MailBox* pMbox = &mailboxes[mboxId];
+
+    stats.depthHistogram[bucket(mailbox_depth(mboxId))]++;
+    stats.waiterHistogram[bucket(pMbox->blockedSenderCount + pMbox->blockedReceiverCount)]++;
+
+    // Recount every so often, walking every mailbox per op would dominate the run
+    if ((stats.sends + stats.receives) % 1024 == 0)
+    {
+        totalSlots = 0;
+        for (int i = 0; i < MAXMBOX; ++i)
+        {
+            if (mailboxes[i].status == MBSTATUS_INUSE)
+                totalSlots += mailbox_depth(i);
+        }
+        if (totalSlots > stats.peakSlots)
+            stats.peakSlots = totalSlots;
+    }
+}
+
+/* Value at the given percentile of a power of two histogram, as the bucket's upper bound */
+static long histogram_percentile(long* histogram, int percent)
+{
+    long total = 0, seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        total += histogram[i];
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += histogram[i];
+        if (total > 0 && seen * 100 >= total * percent)
+            return i == 0 ? 0 : (1L << i) - 1;
+    }
+    return 0;
+}
+
+static void print_histogram(const char* label, long* histogram)
+{
+    int last = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        if (histogram[i])
+            last = i;
+    }
+    printf("  %-14s", label);
+    for (int i = 0; i <= last; ++i)
+    {
+        if (i == 0)
+            printf(" [0]=%ld", histogram[i]);
+        else
+            printf(" [%ld-%ld]=%ld", 1L << (i - 1), (1L << i) - 1, histogram[i]);
+    }
+    printf("\n");
+}
+
+static void reset_run(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    messagesSent = 0;
+    messagesReceived = 0;
+    tick = 0;
+}
+
+/* ------------------------- Workloads ----------------------------------- */
+
+/* Sends messagesPerProducer messages to its mailbox, yielding in between */
+static int producer_process(void* arg)
+{
+    int producer = (int)(intptr_t)arg;
+    int mboxId = producerMbox[producer];
+    StressMessage message;
+
+    for (int i = 0; i < messagesPerProducer; ++i)
+    {
+        message.producer = producer;
+        message.sequence = i;
+        message.ticket = mboxTickets[mboxId]++;
+        message.check = (unsigned int)producer * 2654435761u ^ (unsigned int)i;
+        int result = mailbox_send(mboxId, &message, sizeof(message), TRUE);
+        if (result != 0)
+        {
+            violation("producer %d: mailbox_send returned %d", producer, result);
+            return 1;
+        }
+        messagesSent++;
+        stats.sends++;
+        record_op(mboxId);
+        if (sim_random() % 2)
+            sim_yield();
+    }
+    return 0;
+}
+
+/* Checks one received message against the FIFO and integrity invariants */
+static void check_message(int mboxId, StressMessage* pMessage, int size)
+{
+    if (size != sizeof(StressMessage) ||
+        pMessage->check != ((unsigned int)pMessage->producer * 2654435761u ^ (unsigned int)pMessage->sequence))
+    {
+        violation("mailbox %d: corrupted message", mboxId);
+        return;
+    }
+    if (pMessage->sequence != producerNext[pMessage->producer])
+        violation("producer %d: got sequence %d, expected %d (lost or reordered)",
+                  pMessage->producer, pMessage->sequence, producerNext[pMessage->producer]);
+    producerNext[pMessage->producer] = pMessage->sequence + 1;
+    if (pMessage->ticket <= mboxLastTicket[mboxId])
+        violation("mailbox %d: ticket %ld after %ld, not FIFO", mboxId, pMessage->ticket, mboxLastTicket[mboxId]);
+    mboxLastTicket[mboxId] = pMessage->ticket;
+}
+
+/* Receives consumerQuota messages from its mailbox */
+static int consumer_process(void* arg)
+{
+    int consumer = (int)(intptr_t)arg;
+    int mboxId = consumerMbox[consumer];
+    StressMessage message;
+
+    for (int i = 0; i < consumerQuota; ++i)
+    {
+        int size = mailbox_receive(mboxId, &message, sizeof(message), TRUE);
+        if (size < 0)
+        {
+            violation("consumer %d: mailbox_receive returned %d", consumer, size);
+            return 1;
+        }
+        messagesReceived++;
+        stats.receives++;
+        record_op(mboxId);
+        check_message(mboxId, &message, size);
+        if (sim_random() % 2)
+            sim_yield();
+    }
+    return 0;
+}
+
+static void allocate_workload(int processCount)
+{
+    mboxTickets = calloc(MAXMBOX, sizeof(long));
+    mboxLastTicket = calloc(MAXMBOX, sizeof(long));
+    producerNext = calloc(processCount, sizeof(int));
+    producerMbox = calloc(processCount, sizeof(int));
+    consumerMbox = calloc(processCount, sizeof(int));
+    for (int i = 0; i < MAXMBOX; ++i)
+        mboxLastTicket[i] = -1;
+}
+
+static void release_workload(void)
+{
+    free(mboxTickets);
+    free(mboxLastTicket);
+    free(producerNext);
+    free(producerMbox);
+    free(consumerMbox);
+}
+
+/* Frees every mailbox still in use; runs as a process since waiters make it block */
+static int cleanup_process(void* arg)
+{
+    for (int i = 0; i < MAXMBOX; ++i)
+    {
+        if (mailboxes[i].status == MBSTATUS_INUSE)
+            mailbox_free(i);
+    }
+    return 0;
+}
+
+/* Frees every mailbox still in use and reports messages never received */
+static void free_all_mailboxes(const char* scenario)
+{
+    int leaked = 0;
+    for (int i = 0; i < MAXMBOX; ++i)
+    {
+        if (mailboxes[i].status == MBSTATUS_INUSE)
+            leaked += mailbox_depth(i);
+    }
+    if (leaked)
+        violation("%s: %d messages never received", scenario, leaked);
+
+    k_spawn("cleanup", cleanup_process, NULL, SIM_STACK_SIZE, 1);
+    if (sim_run())
+        violation("%s: processes still blocked after freeing every mailbox", scenario);
+    for (int i = 0; i < MAXMBOX; ++i)
+    {
+        if (mailboxes[i].status != MBSTATUS_EMPTY)
+            violation("%s: mailbox %d left in status %d", scenario, i, mailboxes[i].status);
+    }
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_scale
+   Purpose - processCount producers and as many consumers spread over
+             mailboxes of random slot counts (zero-slot included). Reports
+             throughput, wakeups, waits and queue depths for this load.
+   ----------------------------------------------------------------------- */
+static void scenario_scale(int processCount, int messages)
+{
+    int pairs = processCount / 2;
+    int mboxCount = pairs / 4 > 0 ? pairs / 4 : 1;
+    if (mboxCount > MAXMBOX)
+        mboxCount = MAXMBOX;
+
+    reset_run();
+    allocate_workload(pairs);
+    messagesPerProducer = messages;
+    consumerQuota = messages;
+
+    int* mboxIds = malloc(mboxCount * sizeof(int));
+    for (int i = 0; i < mboxCount; ++i)
+    {
+        int slots = sim_random() % 5 == 0 ? 0 : 1 + sim_random() % 8;
+        mboxIds[i] = mailbox_create(slots, sizeof(StressMessage));
+        if (mboxIds[i] < 0)
+            violation("scale: mailbox_create failed at %d of %d", i, mboxCount);
+    }
+    for (int i = 0; i < pairs; ++i)
+    {
+        producerMbox[i] = consumerMbox[i] = mboxIds[i % mboxCount];
+        k_spawn("producer", producer_process, (void*)(intptr_t)i, SIM_STACK_SIZE, 1);
+        k_spawn("consumer", consumer_process, (void*)(intptr_t)i, SIM_STACK_SIZE, 1);
+    }
+
+    clock_t start = clock();
+    int stuck = sim_run();
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    if (stuck)
+        violation("scale: %d processes still blocked at the end", stuck);
+    if (messagesSent != messagesReceived || messagesSent != (long)pairs * messages)
+        violation("scale: sent %ld, received %ld, expected %ld", messagesSent, messagesReceived, (long)pairs * messages);
+    free_all_mailboxes("scale");
+
+    long ops = stats.sends + stats.receives;
+    printf("scale: %d processes, %d mailboxes, %ld ops in %ld ticks, %.0f ops/s\n",
+           pairs * 2, mboxCount, ops, tick, seconds > 0 ? ops / seconds : 0.0);
+    printf("  wakeups %ld (%.2f per op), blocks %ld, wait p50 <= %ld p99 <= %ld max %ld ticks, peak queued %d (MAXSLOTS %d)\n",
+           stats.wakeups, ops ? (double)stats.wakeups / ops : 0.0, stats.blocks,
+           histogram_percentile(stats.waitHistogram, 50), histogram_percentile(stats.waitHistogram, 99),
+           stats.maxWait, stats.peakSlots, MAXSLOTS);
+    print_histogram("wait ticks", stats.waitHistogram);
+    print_histogram("queue depth", stats.depthHistogram);
+    print_histogram("waiters", stats.waiterHistogram);
+
+    free(mboxIds);
+    release_workload();
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_hot_mailbox
+   Purpose - Hundreds of senders on one single-slot mailbox with a single
+             consumer, so nearly all of them are blocked at once. Tickets
+             must come out in exactly the order they were taken.
+   ----------------------------------------------------------------------- */
+static void scenario_hot_mailbox(int senderCount, int messages)
+{
+    if (senderCount > MAXSLOTS)
+        senderCount = MAXSLOTS;
+
+    reset_run();
+    allocate_workload(senderCount);
+    messagesPerProducer = messages;
+    consumerQuota = senderCount * messages;
+
+    int mboxId = mailbox_create(1, sizeof(StressMessage));
+    for (int i = 0; i < senderCount; ++i)
+    {
+        producerMbox[i] = mboxId;
+        k_spawn("sender", producer_process, (void*)(intptr_t)i, SIM_STACK_SIZE, 1);
+    }
+    consumerMbox[0] = mboxId;
+    k_spawn("drain", consumer_process, (void*)(intptr_t)0, SIM_STACK_SIZE, 1);
+
+    int stuck = sim_run();
+    if (stuck)
+        violation("hot mailbox: %d processes still blocked at the end", stuck);
+    if (messagesReceived != (long)senderCount * messages)
+        violation("hot mailbox: received %ld of %ld", messagesReceived, (long)senderCount * messages);
+    if (mboxLastTicket[mboxId] != (long)senderCount * messages - 1)
+        violation("hot mailbox: last ticket %ld, expected %ld", mboxLastTicket[mboxId], (long)senderCount * messages - 1);
+    free_all_mailboxes("hot mailbox");
+
+    printf("hot mailbox: %d senders, %ld messages, wakeups %ld, wait p99 <= %ld max %ld ticks\n",
+           senderCount, messagesReceived, stats.wakeups,
+           histogram_percentile(stats.waitHistogram, 99), stats.maxWait);
+    print_histogram("waiters", stats.waiterHistogram);
+    release_workload();
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_mailbox_limit
+   Purpose - Creates mailboxes until the table is full, checks the next
+             create fails cleanly and that freed ids can be reused.
+   ----------------------------------------------------------------------- */
+static void scenario_mailbox_limit(void)
+{
+    int created = 0;
+    while (mailbox_create(1 + created % 4, sizeof(int)) >= 0)
+        created++;
+    if (created != MAXMBOX)
+        violation("mailbox limit: created %d, MAXMBOX is %d", created, MAXMBOX);
+
+    int victim = created / 2;
+    mailbox_free(victim);
+    int reused = mailbox_create(1, sizeof(int));
+    if (reused != victim)
+        violation("mailbox limit: freed id %d, create returned %d", victim, reused);
+    if (mailbox_create(1, sizeof(int)) != -1)
+        violation("mailbox limit: create succeeded with the table full");
+
+    free_all_mailboxes("mailbox limit");
+    printf("mailbox limit: %d mailboxes created, create fails cleanly when full, ids reused\n", created);
+}
+
+static int freeTarget;
+
+static int free_waiter_process(void* arg)
+{
+    int sender = (int)(intptr_t)arg;
+    int value = 0;
+    int result = sender ? mailbox_send(freeTarget, &value, sizeof(value), TRUE)
+                        : mailbox_receive(freeTarget, &value, sizeof(value), TRUE);
+    freeResults[result == -5 ? 0 : 1]++;
+    return 0;
+}
+
+static int free_caller_process(void* arg)
+{
+    int result = mailbox_free(freeTarget);
+    if (result != 0)
+        violation("free with waiters: mailbox_free returned %d", result);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_free_with_waiters
+   Purpose - Blocks waiterCount receivers on an empty mailbox and as many
+             senders on a full one, signals a few receivers, then frees
+             both mailboxes. Every waiter must get -5, the signaled ones
+             must leave the wait queue, and both ids must be reusable.
+   ----------------------------------------------------------------------- */
+static void scenario_free_with_waiters(int waiterCount)
+{
+    int value = 0;
+    if (waiterCount > MAXSLOTS)
+        waiterCount = MAXSLOTS;
+
+    reset_run();
+    freeResults[0] = freeResults[1] = 0;
+
+    int receiveMbox = mailbox_create(1, sizeof(int));
+    int sendMbox = mailbox_create(1, sizeof(int));
+    mailbox_send(sendMbox, &value, sizeof(value), FALSE);
+
+    int* pids = malloc(waiterCount * sizeof(int));
+    freeTarget = receiveMbox;
+    for (int i = 0; i < waiterCount; ++i)
+        pids[i] = k_spawn("receiver", free_waiter_process, (void*)(intptr_t)0, SIM_STACK_SIZE, 1);
+    sim_run();
+    freeTarget = sendMbox;
+    for (int i = 0; i < waiterCount; ++i)
+        k_spawn("sender", free_waiter_process, (void*)(intptr_t)1, SIM_STACK_SIZE, 1);
+    sim_run();
+
+    // Signal every tenth receiver, they must drop out of the queue on their own
+    int signaledCount = 0;
+    for (int i = 0; i < waiterCount; i += 10, ++signaledCount)
+        sim_signal(pids[i]);
+    sim_run();
+    if (mailboxes[receiveMbox].blockedReceiverCount != waiterCount - signaledCount)
+        violation("free with waiters: %d receivers queued after %d of %d were signaled",
+                  mailboxes[receiveMbox].blockedReceiverCount, signaledCount, waiterCount);
+
+    freeTarget = receiveMbox;
+    k_spawn("free", free_caller_process, NULL, SIM_STACK_SIZE, 1);
+    if (sim_run() != waiterCount)
+        violation("free with waiters: freeing the receive mailbox did not release its receivers");
+    freeTarget = sendMbox;
+    k_spawn("free", free_caller_process, NULL, SIM_STACK_SIZE, 1);
+    int stuck = sim_run();
+
+    if (stuck)
+        violation("free with waiters: %d processes still blocked", stuck);
+    if (freeResults[0] != waiterCount * 2 || freeResults[1] != 0)
+        violation("free with waiters: %d waiters got -5, %d got something else, expected %d",
+                  freeResults[0], freeResults[1], waiterCount * 2);
+    if (mailboxes[receiveMbox].status != MBSTATUS_EMPTY || mailboxes[sendMbox].status != MBSTATUS_EMPTY)
+        violation("free with waiters: freed mailboxes not reusable");
+    free_all_mailboxes("free with waiters");
+
+    printf("free with waiters: %d receivers (%d signaled first) and %d senders released, wakeups %ld\n",
+           waiterCount, signaledCount, waiterCount, stats.wakeups);
+    free(pids);
+}
+
+/* Sends a ticket taken right before it blocks, so the tickets give the
+ * order the senders entered the wait queue */
+static int limit_sender_process(void* arg)
+{
+    long ticket = limitNextTicket++;
+    int result = mailbox_send(freeTarget, &ticket, sizeof(ticket), TRUE);
+    if (result != 0)
+        limitResults[result == -1 ? 0 : 1]++;
+    return 0;
+}
+
+static int limit_receiver_process(void* arg)
+{
+    long ticket;
+    int result = mailbox_receive(freeTarget, &ticket, sizeof(ticket), TRUE);
+    if (result != sizeof(ticket))
+        limitResults[result == -1 ? 0 : 1]++;
+    return 0;
+}
+
+/* Receives count tickets and checks they come out in the order they were taken */
+static int limit_drain_process(void* arg)
+{
+    int count = (int)(intptr_t)arg;
+    long ticket, last = -1;
+    for (int i = 0; i < count; ++i)
+    {
+        if (mailbox_receive(freeTarget, &ticket, sizeof(ticket), TRUE) != sizeof(ticket) || ticket <= last)
+            violation("wait limit: message %d out of order (ticket %ld after %ld)", i, ticket, last);
+        last = ticket;
+    }
+    return 0;
+}
+
+/* Sends count tickets without blocking on a mailbox with room for them all */
+static int limit_feeder_process(void* arg)
+{
+    int count = (int)(intptr_t)arg;
+    for (int i = 0; i < count; ++i)
+    {
+        long ticket = limitNextTicket++;
+        if (mailbox_send(freeTarget, &ticket, sizeof(ticket), FALSE) != 0)
+            violation("wait limit: feeding ticket %ld failed", ticket);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_wait_limit
+   Purpose - Fills the sender and then the receiver wait queue of a mailbox
+             to MAXSLOTS. The next waiter must be refused with -1 and the
+             ones already queued must still be served in order.
+   ----------------------------------------------------------------------- */
+static void scenario_wait_limit(void)
+{
+    reset_run();
+    limitResults[0] = limitResults[1] = 0;
+    limitNextTicket = 0;
+
+    // A full single-slot mailbox, MAXSLOTS senders parked behind its message
+    freeTarget = mailbox_create(1, sizeof(long));
+    k_spawn("feeder", limit_feeder_process, (void*)(intptr_t)1, SIM_STACK_SIZE, 1);
+    sim_run();
+    for (int i = 0; i < MAXSLOTS; ++i)
+        k_spawn("sender", limit_sender_process, NULL, SIM_STACK_SIZE, 1);
+    if (sim_run() != MAXSLOTS || mailboxes[freeTarget].blockedSenderCount != MAXSLOTS)
+        violation("wait limit: %d senders queued, expected MAXSLOTS", mailboxes[freeTarget].blockedSenderCount);
+    k_spawn("sender", limit_sender_process, NULL, SIM_STACK_SIZE, 1);
+    sim_run();
+    if (limitResults[0] != 1 || limitResults[1] != 0)
+        violation("wait limit: sender past MAXSLOTS not refused (%d refused, %d other failures)",
+                  limitResults[0], limitResults[1]);
+    k_spawn("drain", limit_drain_process, (void*)(intptr_t)(MAXSLOTS + 1), SIM_STACK_SIZE, 1);
+    if (sim_run() != 0)
+        violation("wait limit: processes still blocked after draining the senders");
+    mailbox_free(freeTarget);
+
+    // An empty mailbox, MAXSLOTS receivers waiting on it
+    freeTarget = mailbox_create(MAXSLOTS, sizeof(long));
+    for (int i = 0; i < MAXSLOTS; ++i)
+        k_spawn("receiver", limit_receiver_process, NULL, SIM_STACK_SIZE, 1);
+    if (sim_run() != MAXSLOTS || mailboxes[freeTarget].blockedReceiverCount != MAXSLOTS)
+        violation("wait limit: %d receivers queued, expected MAXSLOTS", mailboxes[freeTarget].blockedReceiverCount);
+    k_spawn("receiver", limit_receiver_process, NULL, SIM_STACK_SIZE, 1);
+    sim_run();
+    if (limitResults[0] != 2 || limitResults[1] != 0)
+        violation("wait limit: receiver past MAXSLOTS not refused (%d refused, %d other failures)",
+                  limitResults[0] - 1, limitResults[1]);
+    k_spawn("feeder", limit_feeder_process, (void*)(intptr_t)MAXSLOTS, SIM_STACK_SIZE, 1);
+    if (sim_run() != 0 || limitResults[1] != 0)
+        violation("wait limit: receivers not all served after MAXSLOTS sends");
+    free_all_mailboxes("wait limit");
+
+    printf("wait limit: %d senders and %d receivers queued, the next of each refused, wakeups %ld\n",
+           MAXSLOTS, MAXSLOTS, stats.wakeups);
+}
+
+static int freeSignaledResults[3];  /* frees that returned 0, -5, anything else */
+static int freePid;
+
+/* Frees freeTarget, then checks the mailbox really is free and reusable */
+static int free_signaled_process(void* arg)
+{
+    int waiterCount = (int)(intptr_t)arg;
+    int result = mailbox_free(freeTarget);
+    sim_clear_signal();
+    freeSignaledResults[result == 0 ? 0 : result == -5 ? 1 : 2]++;
+
+    if (mailboxes[freeTarget].status != MBSTATUS_EMPTY || mailboxes[freeTarget].releasingCount != 0)
+        violation("free signaled: mailbox_free returned %d with the mailbox in status %d, %d waiters inside",
+                  result, mailboxes[freeTarget].status, mailboxes[freeTarget].releasingCount);
+    if (freeResults[0] + freeResults[1] != waiterCount)
+        violation("free signaled: mailbox_free returned %d with %d of %d waiters still inside",
+                  result, waiterCount - freeResults[0] - freeResults[1], waiterCount);
+    int reused = mailbox_create(1, sizeof(int));
+    if (reused < 0 || mailbox_free(reused) != 0)
+        violation("free signaled: mailbox not reusable after a signaled free");
+    return 0;
+}
+
+/* Signals the freeing process once it waits for the released waiters */
+static int free_signaller_process(void* arg)
+{
+    while (processes[freePid - 1].state != PROC_BLOCKED && processes[freePid - 1].state != PROC_FREE &&
+           processes[freePid - 1].state != PROC_EXITED)
+        sim_yield();
+    if (processes[freePid - 1].state == PROC_BLOCKED)
+        sim_signal(freePid);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_free_signaled
+   Purpose - Frees a mailbox with receivers waiting and signals the caller
+             of mailbox_free while it waits for them to leave. The free must
+             still not return before every waiter is out of the mailbox.
+   ----------------------------------------------------------------------- */
+static void scenario_free_signaled(int waiterCount, int rounds)
+{
+    reset_run();
+    memset(freeSignaledResults, 0, sizeof(freeSignaledResults));
+
+    for (int round = 0; round < rounds; ++round)
+    {
+        freeResults[0] = freeResults[1] = 0;
+        freeTarget = mailbox_create(1, sizeof(int));
+        for (int i = 0; i < waiterCount; ++i)
+            k_spawn("receiver", free_waiter_process, (void*)(intptr_t)0, SIM_STACK_SIZE, 1);
+        sim_run();
+        freePid = k_spawn("free", free_signaled_process, (void*)(intptr_t)waiterCount, SIM_STACK_SIZE, 1);
+        k_spawn("signaller", free_signaller_process, NULL, SIM_STACK_SIZE, 1);
+        if (sim_run() != 0)
+            violation("free signaled: processes still blocked after round %d", round);
+    }
+    if (freeSignaledResults[2] != 0)
+        violation("free signaled: mailbox_free returned something other than 0 or -5 %d times", freeSignaledResults[2]);
+    free_all_mailboxes("free signaled");
+
+    printf("free signaled: %d rounds of %d receivers, %d frees signaled while waiting, %ld wakeups refused to signaled processes\n",
+           rounds, waiterCount, freeSignaledResults[1], stats.signalRaces);
+}
+
+/* Answers calls until its mailbox is freed, replying with value * 2 */
+static int call_server_process(void* arg)
+{
+    CallMessage request, reply;
+    int callerPid, callSequence;
+
+    while (mailbox_receive_call(callMbox, &request, sizeof(request), &callerPid, &callSequence) >= 0)
+    {
+        if (callerPid <= 0 || callSequence <= 0)
+        {
+            violation("call/reply: request without a caller (pid %d, sequence %d)", callerPid, callSequence);
+            continue;
+        }
+        reply = request;
+        reply.value = request.value * 2;
+        // Take a while so callers pile up waiting for replies
+        for (int i = sim_random() % 8; i > 0; --i)
+            sim_yield();
+        if (mailbox_reply(callerPid, callSequence, &reply, sizeof(reply)) < 0)
+            callStats.staleReplies++;
+    }
+    return 0;
+}
+
+/* Makes callsPerClient calls and checks every reply belongs to its own call.
+ * A signaled call is abandoned and the next one must not see its reply. */
+static int call_client_process(void* arg)
+{
+    int client = (int)(intptr_t)arg;
+    CallMessage request, reply;
+
+    for (int call = 0; call < callsPerClient; ++call)
+    {
+        request.client = client;
+        request.call = call;
+        request.value = (int)(sim_random() % 100000);
+        memset(&reply, 0, sizeof(reply));
+        int result = mailbox_call(callMbox, &request, sizeof(request), &reply, sizeof(reply));
+        if (signaled())
+        {
+            // The reply may have won the race with the signal
+            sim_clear_signal();
+            if (result == -5)
+            {
+                callStats.abandoned++;
+                continue;
+            }
+        }
+        if (result == -5 && mailboxes[callMbox].status != MBSTATUS_INUSE)
+        {
+            callStats.released++;
+            break;
+        }
+        if (result != sizeof(reply) || reply.client != client || reply.call != call ||
+            reply.value != request.value * 2)
+            violation("call/reply: client %d call %d got result %d, reply for client %d call %d",
+                      client, call, result, reply.client, reply.call);
+        else
+            callStats.completed++;
+    }
+    callClientsDone++;
+    return 0;
+}
+
+/* Signals random clients while they wait for a reply */
+static int call_signaller_process(void* arg)
+{
+    while (callClientsDone < callClientCount)
+    {
+        int pid = callClientPids[sim_random() % callClientCount];
+        if (processes[pid - 1].state == PROC_BLOCKED && processes[pid - 1].blockStatus == BLOCKED_CALL)
+            sim_signal(pid);
+        sim_yield();
+    }
+    return 0;
+}
+
+/* The send/receive equivalent of call_server_process: replies to the
+ * mailbox named in the request until its own mailbox is freed */
+static int rpc_server_process(void* arg)
+{
+    CallMessage request;
+
+    while (mailbox_receive(callMbox, &request, sizeof(request), TRUE) >= 0)
+    {
+        request.value *= 2;
+        for (int i = sim_random() % 8; i > 0; --i)
+            sim_yield();
+        mailbox_send(request.replyMbox, &request, sizeof(request), TRUE);
+    }
+    return 0;
+}
+
+/* The send/receive equivalent of call_client_process, with a reply mailbox of its own */
+static int rpc_client_process(void* arg)
+{
+    int client = (int)(intptr_t)arg;
+    CallMessage request, reply;
+
+    request.replyMbox = mailbox_create(1, sizeof(CallMessage));
+    for (int call = 0; call < callsPerClient; ++call)
+    {
+        request.client = client;
+        request.call = call;
+        request.value = (int)(sim_random() % 100000);
+        if (mailbox_send(callMbox, &request, sizeof(request), TRUE) != 0 ||
+            mailbox_receive(request.replyMbox, &reply, sizeof(reply), TRUE) != sizeof(reply) ||
+            reply.client != client || reply.call != call || reply.value != request.value * 2)
+            violation("call/reply: send/receive client %d call %d got the wrong reply", client, call);
+        else
+            callStats.completed++;
+    }
+    mailbox_free(request.replyMbox);
+    callClientsDone++;
+    return 0;
+}
+
+/* Runs clientCount clients of serverCount servers with no signals and
+ * reports the blocks, wakeups and ticks one round trip took */
+static void call_cost(int clientCount, int serverCount, int calls, int useCall, double cost[3])
+{
+    reset_run();
+    memset(&callStats, 0, sizeof(callStats));
+    callsPerClient = calls;
+    callClientsDone = 0;
+
+    callMbox = mailbox_create(4, sizeof(CallMessage));
+    for (int i = 0; i < serverCount; ++i)
+        k_spawn("server", useCall ? call_server_process : rpc_server_process, NULL, SIM_STACK_SIZE, 1);
+    for (int i = 0; i < clientCount; ++i)
+        k_spawn("client", useCall ? call_client_process : rpc_client_process, (void*)(intptr_t)i, SIM_STACK_SIZE, 1);
+    if (sim_run() != serverCount || callStats.completed != (long)clientCount * calls)
+        violation("call/reply: %ld of %ld %s round trips completed", callStats.completed,
+                  (long)clientCount * calls, useCall ? "mailbox_call" : "send/receive");
+
+    // Before the cleanup adds its own blocks and wakeups
+    long roundTrips = callStats.completed > 0 ? callStats.completed : 1;
+    cost[0] = (double)stats.blocks / roundTrips;
+    cost[1] = (double)stats.wakeups / roundTrips;
+    cost[2] = (double)tick / roundTrips;
+    free_all_mailboxes("call/reply");
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_call_reply
+   Purpose - clientCount clients call a pool of servers through one mailbox
+             while a signaller interrupts random calls, so stale replies to
+             abandoned calls meet newer calls of the same client. Then a
+             mailbox with no server is freed with calls queued and parked,
+             and every one of those callers must get -5. Last, the same load
+             without signals is run through mailbox_call and through a send
+             followed by a receive on a reply mailbox, to compare what a
+             round trip costs.
+   ----------------------------------------------------------------------- */
+static void scenario_call_reply(int clientCount, int calls)
+{
+    int serverCount = clientCount / 16 > 0 ? clientCount / 16 : 1;
+
+    reset_run();
+    memset(&callStats, 0, sizeof(callStats));
+    callsPerClient = calls;
+    callClientCount = clientCount;
+    callClientsDone = 0;
+    callClientPids = malloc(clientCount * sizeof(int));
+
+    callMbox = mailbox_create(4, sizeof(CallMessage));
+    for (int i = 0; i < serverCount; ++i)
+        k_spawn("server", call_server_process, NULL, SIM_STACK_SIZE, 1);
+    for (int i = 0; i < clientCount; ++i)
+        callClientPids[i] = k_spawn("client", call_client_process, (void*)(intptr_t)i, SIM_STACK_SIZE, 1);
+    k_spawn("signaller", call_signaller_process, NULL, SIM_STACK_SIZE, 1);
+
+    int stuck = sim_run();
+    if (stuck != serverCount)
+        violation("call/reply: %d processes blocked at the end, expected the %d servers", stuck, serverCount);
+    if (callStats.completed + callStats.abandoned != (long)clientCount * calls)
+        violation("call/reply: %ld completed and %ld abandoned of %ld calls",
+                  callStats.completed, callStats.abandoned, (long)clientCount * calls);
+    if (callStats.staleReplies > callStats.abandoned)
+        violation("call/reply: %ld replies refused for %ld abandoned calls", callStats.staleReplies, callStats.abandoned);
+    free_all_mailboxes("call/reply");
+    printf("call/reply: %d clients, %d servers, %ld calls completed, %ld abandoned, %ld stale replies dropped\n",
+           clientCount, serverCount, callStats.completed, callStats.abandoned, callStats.staleReplies);
+
+    // Nobody serves this one: two requests fit, the rest of the callers park
+    memset(&callStats, 0, sizeof(callStats));
+    callsPerClient = 1;
+    callClientsDone = 0;
+    callMbox = mailbox_create(2, sizeof(CallMessage));
+    for (int i = 0; i < clientCount; ++i)
+        k_spawn("client", call_client_process, (void*)(intptr_t)i, SIM_STACK_SIZE, 1);
+    if (sim_run() != clientCount)
+        violation("call/reply: callers of an unserved mailbox did not all block");
+    freeTarget = callMbox;
+    k_spawn("free", free_caller_process, NULL, SIM_STACK_SIZE, 1);
+    stuck = sim_run();
+    if (stuck)
+        violation("call/reply: %d processes still blocked after freeing the call mailbox", stuck);
+    if (callStats.released != clientCount)
+        violation("call/reply: %ld of %d callers released by mailbox_free", callStats.released, clientCount);
+    if (mailboxes[callMbox].status != MBSTATUS_EMPTY)
+        violation("call/reply: freed call mailbox not reusable");
+    printf("call/reply: freeing an unserved mailbox released %ld of %d callers\n", callStats.released, clientCount);
+
+    double callCost[3], rpcCost[3];
+    call_cost(clientCount, serverCount, calls, TRUE, callCost);
+    call_cost(clientCount, serverCount, calls, FALSE, rpcCost);
+    printf("call/reply: per round trip, mailbox_call %.2f blocks %.2f wakeups %.1f ticks, "
+           "send/receive %.2f blocks %.2f wakeups %.1f ticks\n",
+           callCost[0], callCost[1], callCost[2], rpcCost[0], rpcCost[1], rpcCost[2]);
+    // Both block the client once per call, the margin only absorbs the random schedule
+    if (callCost[0] > rpcCost[0] * 1.1 || callCost[1] > rpcCost[1] * 1.1)
+        violation("call/reply: mailbox_call blocks or wakes more per round trip than send/receive");
+
+    free(callClientPids);
+}
+
+/* ------------------------- Devices ------------------------------------- */
+
+/* Plays the hardware: raises transmit-ready and disk completion interrupts
+ * a random while after they were started. Exits once nothing is in flight
+ * and no other process can run, since no interrupt could follow. */
+static int device_process(void* arg)
+{
+    while (1)
+    {
+        int inFlight = 0;
+        for (int unit = 0; unit < TERMINAL_COUNT; ++unit)
+        {
+            if (termTransmitPending[unit] && sim_random() % 2)
+            {
+                termTransmitPending[unit] = 0;
+                sim_raise_io(FIRST_TERMINAL_INDEX + unit, SIM_TERM_XMIT_READY);
+            }
+            inFlight |= termTransmitPending[unit];
+        }
+        for (int unit = 0; unit < DISK_COUNT; ++unit)
+        {
+            if (diskBusy[unit] && !diskHoldCompletions && sim_random() % 4 == 0)
+            {
+                diskBusy[unit] = 0;
+                sim_raise_io(unit, 0);
+            }
+            inFlight |= diskBusy[unit];
+        }
+        if (!inFlight && readyCount == 0)
+            return 0;
+        sim_yield();
+    }
+}
+
+/* Types a terminal's input as receive interrupts, never getting more than
+ * a ring ahead of the reader so no byte is dropped */
+static int keyboard_process(void* arg)
+{
+    int unit = (int)(intptr_t)arg;
+
+    while (termTyped[unit] < SIM_TERM_BYTES)
+    {
+        if (termTyped[unit] - termRead[unit] < TERM_RING_SIZE)
+        {
+            unsigned char ch = termInput[unit][termTyped[unit]++];
+            sim_raise_io(FIRST_TERMINAL_INDEX + unit, SIM_TERM_RECV_READY | ch);
+        }
+        if (sim_random() % 2)
+            sim_yield();
+    }
+    return 0;
+}
+
+/* Reads a terminal until all its input has arrived and checks it. In line
+ * mode every read has to end on a newline. */
+static int terminal_reader_process(void* arg)
+{
+    int unit = (int)(intptr_t)arg;
+    int lineMode = unit % 2;
+    unsigned char buffer[128];
+
+    while (termRead[unit] < SIM_TERM_BYTES)
+    {
+        int size = lineMode ? sizeof(buffer) : 1 + sim_random() % 16;
+        int result = term_read(unit, buffer, size, lineMode);
+        if (result <= 0 || result > size)
+        {
+            violation("term%d: term_read returned %d", unit, result);
+            return 1;
+        }
+        if (memcmp(buffer, &termInput[unit][termRead[unit]], result) != 0)
+            violation("term%d: bytes %d-%d read back wrong", unit, termRead[unit], termRead[unit] + result - 1);
+        if (lineMode && buffer[result - 1] != '\n')
+            violation("term%d: line mode read of %d bytes without a newline", unit, result);
+        termRead[unit] += result;
+    }
+    return 0;
+}
+
+/* Writes a terminal's input to its output in random sized chunks */
+static int terminal_writer_process(void* arg)
+{
+    int unit = (int)(intptr_t)arg;
+
+    for (int written = 0; written < SIM_TERM_BYTES; )
+    {
+        int size = 1 + sim_random() % 600;
+        if (size > SIM_TERM_BYTES - written)
+            size = SIM_TERM_BYTES - written;
+        int result = term_write(unit, &termInput[unit][written], size);
+        if (result != size)
+        {
+            violation("term%d: term_write of %d bytes returned %d", unit, size, result);
+            return 1;
+        }
+        written += size;
+    }
+    return 0;
+}
+
+/* Waits for input that never comes, the harness signals it */
+static int idle_reader_process(void* arg)
+{
+    unsigned char buffer[16];
+    int result = term_read((int)(intptr_t)arg, buffer, sizeof(buffer), FALSE);
+    if (result != -5)
+        violation("term%d: signaled term_read returned %d", (int)(intptr_t)arg, result);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_terminals
+   Purpose - Pushes SIM_TERM_BYTES through term0 (raw) and term1 (line
+             mode) as receive interrupts and through term2 with term_write,
+             while a reader waits on an idle term3 until it is signaled.
+             Every byte must arrive once and in order, and wait_device must
+             refuse terminals now that the rings own them.
+   ----------------------------------------------------------------------- */
+static void scenario_terminals(void)
+{
+    int status;
+
+    reset_run();
+    for (int unit = 0; unit < TERMINAL_COUNT; ++unit)
+    {
+        for (int i = 0; i < SIM_TERM_BYTES; ++i)
+        {
+            // Lines of up to 80 characters, and the last byte ends a line
+            unsigned int r = sim_random();
+            termInput[unit][i] = (r % 40 == 0 || i == SIM_TERM_BYTES - 1 ||
+                                  (i >= 80 && memchr(&termInput[unit][i - 80], '\n', 80) == NULL))
+                                     ? '\n' : 'a' + r % 26;
+        }
+    }
+
+    if (wait_device("term0", &status) != -1)
+        violation("terminals: wait_device accepted a terminal");
+
+    k_spawn("device", device_process, NULL, SIM_STACK_SIZE, 1);
+    for (int unit = 0; unit < 2; ++unit)
+    {
+        k_spawn("keyboard", keyboard_process, (void*)(intptr_t)unit, SIM_STACK_SIZE, 1);
+        k_spawn("reader", terminal_reader_process, (void*)(intptr_t)unit, SIM_STACK_SIZE, 1);
+    }
+    k_spawn("writer", terminal_writer_process, (void*)(intptr_t)2, SIM_STACK_SIZE, 1);
+    int idlePid = k_spawn("idle reader", idle_reader_process, (void*)(intptr_t)3, SIM_STACK_SIZE, 1);
+
+    if (sim_run() != 1)
+        violation("terminals: only the idle reader should be blocked at the end");
+    sim_signal(idlePid);
+    if (sim_run() != 0)
+        violation("terminals: idle reader still blocked after it was signaled");
+
+    for (int unit = 0; unit < 2; ++unit)
+    {
+        if (termRead[unit] != SIM_TERM_BYTES)
+            violation("term%d: read %d of %d bytes", unit, termRead[unit], SIM_TERM_BYTES);
+    }
+    if (termOutputCount[2] != SIM_TERM_BYTES || memcmp(termOutput[2], termInput[2], SIM_TERM_BYTES) != 0)
+        violation("term2: transmitted %d of %d bytes or out of order", termOutputCount[2], SIM_TERM_BYTES);
+
+    printf("terminals: %d bytes read raw and in line mode, %d written, signaled reader released, wakeups %ld\n",
+           SIM_TERM_BYTES, termOutputCount[2], stats.wakeups);
+}
+
+/* Issues count one-sector requests starting at track/sector, ids from firstId */
+static void disk_issue(int unit, int operation, int track, int sector, int count, int firstId,
+                       unsigned char* pBuffers, int replyMbox)
+{
+    DiskRequest request;
+
+    memset(&request, 0, sizeof(request));
+    request.operation = operation;
+    request.replyMbox = replyMbox;
+    request.sectorCount = 1;
+    for (int i = 0; i < count; ++i)
+    {
+        request.track = track;
+        request.firstSector = sector + i;
+        request.pBuffer = pBuffers + i * DISK_SECTOR_SIZE;
+        request.requestId = firstId + i;
+        if (disk_request_async(unit, &request) != 0)
+            violation("disk%d: request %d refused", unit, request.requestId);
+    }
+}
+
+/* Collects count replies and checks each id from firstId came back once,
+ * with expectedStatus unless that is SIM_ANY_STATUS */
+static void disk_collect(int replyMbox, int count, int firstId, int expectedStatus)
+{
+    DiskReply reply;
+    char seen[DISK_SECTORS_PER_TRACK * 2] = {0};
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (disk_request_wait(replyMbox, &reply) != 0)
+        {
+            violation("disk: disk_request_wait failed");
+            return;
+        }
+        int index = reply.requestId - firstId;
+        if (index < 0 || index >= count || seen[index]++)
+            violation("disk: unexpected or repeated reply for request %d", reply.requestId);
+        if (expectedStatus != SIM_ANY_STATUS && reply.status != expectedStatus)
+            violation("disk: request %d finished with status %d, expected %d", reply.requestId, reply.status, expectedStatus);
+    }
+    if (mailbox_receive(replyMbox, &reply, sizeof(reply), FALSE) != -2)
+        violation("disk: more replies than requests");
+}
+
+static unsigned char diskBuffers[2][DISK_SECTORS_PER_TRACK * DISK_SECTOR_SIZE];
+
+/* Writes a whole track of random bytes one sector per request, then reads it
+ * back the same way. Ids firstId and firstId + 100 are used. */
+static void disk_track_roundtrip(int unit, int track, int firstId, int replyMbox)
+{
+    for (int i = 0; i < (int)sizeof(diskBuffers[0]); ++i)
+        diskBuffers[0][i] = (unsigned char)sim_random();
+    disk_issue(unit, DISK_REQUEST_WRITE, track, 0, DISK_SECTORS_PER_TRACK, firstId, diskBuffers[0], replyMbox);
+    disk_collect(replyMbox, DISK_SECTORS_PER_TRACK, firstId, 0);
+    disk_issue(unit, DISK_REQUEST_READ, track, 0, DISK_SECTORS_PER_TRACK, firstId + 100, diskBuffers[1], replyMbox);
+    disk_collect(replyMbox, DISK_SECTORS_PER_TRACK, firstId + 100, 0);
+    if (memcmp(diskBuffers[0], diskBuffers[1], sizeof(diskBuffers[0])) != 0)
+        violation("disk%d: track %d read back differs from what was written", unit, track);
+}
+
+/* Drives the disk service through merging, failures, shutdown and signals */
+static int disk_test_process(void* arg)
+{
+    unsigned char (*buffers)[DISK_SECTORS_PER_TRACK * DISK_SECTOR_SIZE] = diskBuffers;
+    int replyMbox = mailbox_create(DISK_SECTORS_PER_TRACK * 2, sizeof(DiskReply));
+    DiskReply reply;
+    int exitCode;
+
+    // Write a whole track, then read it back: C-LOOK must merge, data must survive it
+    disk_service_start(0, DISK_SCHED_CLOOK);
+    disk_track_roundtrip(0, 5, 0, replyMbox);
+    if (disk_service_stats(0)->transfers >= disk_service_stats(0)->requestsServed)
+        violation("disk0: %d transfers for %d requests, nothing merged",
+                  disk_service_stats(0)->transfers, disk_service_stats(0)->requestsServed);
+
+    // A refused transfer fails its requests instead of waiting for an interrupt
+    diskFailTransfers = 1;
+    disk_issue(0, DISK_REQUEST_READ, 9, 3, 1, 200, buffers[1], replyMbox);
+    disk_collect(replyMbox, 1, 200, -1);
+    disk_issue(0, DISK_REQUEST_READ, 9, 3, 1, 201, buffers[1], replyMbox);
+    disk_collect(replyMbox, 1, 201, 0);
+
+    // A requester that does not read its replies must not hold up the others.
+    // Its four sectors are next under the head and merge into one transfer,
+    // only the first completion fits its mailbox.
+    int lazyMbox = mailbox_create(1, sizeof(DiskReply));
+    disk_issue(0, DISK_REQUEST_READ, 9, 5, 4, 600, buffers[1], lazyMbox);
+    disk_issue(0, DISK_REQUEST_READ, 12, 0, 8, 700, buffers[1] + 4 * DISK_SECTOR_SIZE, replyMbox);
+    disk_collect(replyMbox, 8, 700, 0);
+
+    // Stop with requests still queued: they are served, later ones refused
+    disk_issue(0, DISK_REQUEST_READ, 20, 0, DISK_SECTORS_PER_TRACK, 300, buffers[1], replyMbox);
+    if (disk_service_stop(0) != 0)
+        violation("disk0: disk_service_stop failed");
+    disk_collect(replyMbox, DISK_SECTORS_PER_TRACK, 300, 0);
+    DiskRequest late = {DISK_REQUEST_READ, 0, 0, 1, buffers[1], replyMbox, 400};
+    if (disk_request_async(0, &late) != -1)
+        violation("disk0: request accepted after the service stopped");
+    k_wait(&exitCode);
+    if (exitCode != 0)
+        violation("disk0: driver exited with %d after a shutdown", exitCode);
+    if (disk_service_stats(0)->repliesDropped != 3 || disk_request_wait(lazyMbox, &reply) != 0 || reply.requestId != 600)
+        violation("disk0: %d completions dropped for a requester not reading them, expected 3",
+                  disk_service_stats(0)->repliesDropped);
+    mailbox_free(lazyMbox);
+
+    // An idle driver that is signaled exits and the service can start again
+    disk_service_start(1, DISK_SCHED_FIFO);
+    int driverPid = disk_service_stats(1)->driverPid;
+    while (processes[driverPid - 1].state != PROC_BLOCKED)
+        sim_yield();
+    sim_signal(driverPid);
+    k_wait(&exitCode);
+    if (exitCode != -5 || disk_service_stats(1)->driverPid != 0)
+        violation("disk1: signaled idle driver exited with %d", exitCode);
+    if (disk_service_start(1, DISK_SCHED_FIFO) < 0 || disk_service_stop(1) != 0)
+        violation("disk1: could not restart the service after its driver was signaled");
+    k_wait(&exitCode);
+
+    // A driver signaled while a transfer is running waits for its completion
+    // before it leaves, so the next driver does not take it for its own
+    diskHoldCompletions = 1;
+    disk_service_start(0, DISK_SCHED_CLOOK);
+    driverPid = disk_service_stats(0)->driverPid;
+    disk_issue(0, DISK_REQUEST_WRITE, 7, 0, DISK_SECTORS_PER_TRACK, 800, buffers[0], replyMbox);
+    while (!diskBusy[0] || processes[driverPid - 1].state != PROC_BLOCKED)
+        sim_yield();
+    sim_signal(driverPid);
+    diskHoldCompletions = 0;
+    disk_collect(replyMbox, DISK_SECTORS_PER_TRACK, 800, SIM_ANY_STATUS);
+    k_wait(&exitCode);
+    if (exitCode != -5 || diskBusy[0])
+        violation("disk0: driver signaled mid-transfer exited with %d, transfer %s",
+                  exitCode, diskBusy[0] ? "still running" : "finished");
+    if (disk_service_start(0, DISK_SCHED_CLOOK) < 0)
+        violation("disk0: could not restart the service after its driver was signaled mid-transfer");
+    disk_track_roundtrip(0, 11, 900, replyMbox);
+    disk_service_stop(0);
+    k_wait(&exitCode);
+    mailbox_free(replyMbox);
+
+    // Same request stream under both policies, C-LOOK must seek less
+    int fifoTracks = disk_workload_run(1, DISK_SCHED_FIFO, 8, 64, diskTestSeed);
+    int fifoServed = disk_service_stats(1)->requestsServed;
+    int clookTracks = disk_workload_run(1, DISK_SCHED_CLOOK, 8, 64, diskTestSeed);
+    int clookServed = disk_service_stats(1)->requestsServed;
+    if (fifoServed != 8 * 64 || clookServed != 8 * 64)
+        violation("disk1: workload served %d (FIFO) and %d (C-LOOK) of %d requests", fifoServed, clookServed, 8 * 64);
+    if (clookTracks >= fifoTracks)
+        violation("disk1: C-LOOK moved %d tracks, FIFO %d", clookTracks, fifoTracks);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - scenario_disks
+   Purpose - Runs the disk service against simulated disks: merged writes
+             and reads of a track, a refused transfer, a requester that does
+             not read its replies, stopping with work queued, a driver
+             signaled while idle and while a transfer runs, and a FIFO/C-LOOK
+             comparison.
+   ----------------------------------------------------------------------- */
+static void scenario_disks(void)
+{
+    reset_run();
+    diskTestSeed = (int)sim_random();
+    k_spawn("device", device_process, NULL, SIM_STACK_SIZE, 1);
+    k_spawn("disk test", disk_test_process, NULL, SIM_STACK_SIZE, 1);
+    int stuck = sim_run();
+    if (stuck)
+        violation("disks: %d processes still blocked at the end", stuck);
+    printf("disks: merging, refused transfers, dropped replies, stop and signaled drivers checked, wakeups %ld\n",
+           stats.wakeups);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long long seed = 1;
+    int maxProcs = 4096;
+    int messages = 32;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--seed") == 0)
+            seed = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "--max-procs") == 0)
+            maxProcs = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--messages") == 0)
+            messages = atoi(argv[i + 1]);
+    }
+    if (maxProcs > SIM_MAX_PROCS - 1)
+        maxProcs = SIM_MAX_PROCS - 1;
+    rngState = seed ? seed : 1;
+
+    printf("seed %llu, up to %d processes, %d messages per producer\n", seed, maxProcs, messages);
+
+    scenario_mailbox_limit();
+    scenario_free_with_waiters(maxProcs / 8 > 10 ? maxProcs / 8 : 10);
+    scenario_wait_limit();
+    scenario_free_signaled(maxProcs / 64 > 4 ? maxProcs / 64 : 4, 32);
+    scenario_hot_mailbox(maxProcs / 8 > 10 ? maxProcs / 8 : 10, 4);
+    scenario_call_reply(maxProcs / 8 > 64 ? maxProcs / 8 : 64, 8);
+    for (int processCount = 64; processCount <= maxProcs; processCount *= 4)
+        scenario_scale(processCount, messages);
+
+    // The device scenarios share the mailboxes SchedulerEntryPoint creates, so they go last
+    k_spawn("scheduler", SchedulerEntryPoint, NULL, SIM_STACK_SIZE, 1);
+    if (sim_run())
+        violation("SchedulerEntryPoint did not finish");
+    scenario_terminals();
+    scenario_disks();
+
+    printf("%s: %d invariant violations\n", violations ? "FAIL" : "PASS", violations);
+    return violations ? 1 : 0;
+}
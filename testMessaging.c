@@ -28,6 +28,24 @@ static void InitializeHandlers();
 static int check_io_messaging(void);
 extern int MessagingEntryPoint(void*);
 static void checkKernelMode(const char* functionName);
+static void io_handler(char deviceId[32], uint8_t command, uint32_t status, void* pArgs);
+static int device_index(const char* deviceName);
+static int term_ring_put(TermRing* pRing, unsigned char ch);
+static int term_ring_get(TermRing* pRing, unsigned char* pCh);
+static int send_message(int mboxId, void* pMsg, int msg_size, int wait, int callerPid, int callSequence);
+static int receive_message(int mboxId, void* pMsg, int msg_size, int wait, int* pCallerPid, int* pCallSequence);
+static CallChannel* find_call(int pid, int sequence);
+static void unlink_call(CallChannel* pChannel);
+static int slot_count(MailBox* pMbox);
+static void append_slot(SlotPtr* pListHead, SlotPtr newSlot);
+static void wake_receiver(MailBox* pMbox);
+static void leave_released_mailbox(MailBox* pMbox);
+static void deliver_waiting_sender(MailBox* pMbox);
+static int wait_queue_remove(int* queue, int* pHead, int* pTail, int* pCount, int pid);
+static int disk_driver(void* arg);
+static void disk_queue_insert(DiskService* pService, DiskRequest* pRequest);
+static int disk_next_request(DiskService* pService);
+static void disk_reply(DiskService* pService, int replyMbox, int requestId, int status);
 
 struct psr_bits {
     unsigned int cur_int_enable : 1;
@@ -67,6 +85,16 @@ static DeviceManagementData devices[THREADS_MAX_DEVICES];
 static int nextMailboxId = 0;
 static int waitingOnDevice = 0;
 
+/* calls waiting for a reply, each channel lives on its caller's stack */
+static CallChannel* pActiveCalls = NULL;
+static int nextCallSequence = 0;
+
+/* per-terminal receive/transmit rings, indexed by terminal unit */
+static TerminalData terminals[TERMINAL_COUNT];
+
+/* per-disk request queues, indexed by disk unit */
+static DiskService diskServices[DISK_COUNT];
+
 
 /* ------------------------------------------------------------------------
      Name - SchedulerEntryPoint
@@ -133,6 +161,8 @@ int SchedulerEntryPoint(void* arg)
             strncpy(devices[2 + i].deviceName, termName, sizeof(devices[2 + i].deviceName));
             devices[2 + i].deviceType = DEVICE_TERMINAL;
         }
+        // The device mailbox wakes readers, this one wakes writers waiting on ring space
+        terminals[i].transmitMbox = mailbox_create(1, sizeof(int));
     }       
 
     InitializeHandlers();
@@ -166,7 +196,7 @@ int mailbox_create(int slots, int slot_size)
 {
     // Find a free mailbox slot
     for (int i = 0; i < MAXMBOX; ++i) {
-        if (mailboxes[i].status != MBSTATUS_INUSE) {// Check if the mailbox is free (i.e., not in use)
+        if (mailboxes[i].status == MBSTATUS_EMPTY) {// Check if the mailbox is free (i.e., not in use or being released)
             // Initialize mailbox fields
             mailboxes[i].mbox_id = i; // Assign a unique mailbox ID (can be the index in the mailboxes array)
             mailboxes[i].slotCount = slots; // Set the number of slots in the mailbox
@@ -174,6 +204,18 @@ int mailbox_create(int slots, int slot_size)
             mailboxes[i].status = MBSTATUS_INUSE; // Mark the mailbox as in use
             mailboxes[i].type = (slots == 0) ? MB_ZEROSLOT : (slots == 1 ? MB_SINGLESLOT : MB_MULTISLOT); // Determine the mailbox type based on the number of slots
             mailboxes[i].pSlotListHead = NULL; // Initialize the slot list head to NULL
+            // Reset the wait queues left over from a previous user of this mailbox
+            mailboxes[i].blockedSenderCount = 0;
+            mailboxes[i].blockedSenderHead = 0;
+            mailboxes[i].blockedSenderTail = 0;
+            mailboxes[i].releaseBlockedSenders = 0;
+            mailboxes[i].blockedReceiverCount = 0;
+            mailboxes[i].blockedReceiverHead = 0;
+            mailboxes[i].blockedReceiverTail = 0;
+            mailboxes[i].releaseBlockedReceivers = 0;
+            mailboxes[i].releasingCount = 0;
+            mailboxes[i].pWaitingSlotListHead = NULL;
+            mailboxes[i].pendingReceivers = 0;
             // Other fields can be initialized as needed
             return i;
         }
@@ -188,32 +230,27 @@ int mailbox_create(int slots, int slot_size)
              Block the sending process if no slot available.
    Parameters - mailbox id, pointer to data of msg, # of bytes in msg,
                 block flag.
-   Returns - zero if successful, -1 if invalid args, -2 if would block
+   Returns - zero if successful, -1 if invalid args or MAXSLOTS senders
+             are already blocked on the mailbox, -2 if would block
              (non-blocking mode), -5 if signaled while waiting.
    Side Effects - none.
    ----------------------------------------------------------------------- */
 int mailbox_send(int mboxId, void* pMsg, int msg_size, int wait)
+{
+    return send_message(mboxId, pMsg, msg_size, wait, 0, 0);
+}
+
+/* Common send path, callerPid and callSequence tag the message with a call
+ * waiting in mailbox_call */
+static int send_message(int mboxId, void* pMsg, int msg_size, int wait, int callerPid, int callSequence)
 {
     // Validate mailbox id
     if (mboxId < 0 || mboxId >= MAXMBOX || mailboxes[mboxId].status != MBSTATUS_INUSE)
         return -1;
+    MailBox* pMbox = &mailboxes[mboxId];
     // Validate message size
-    if (msg_size > mailboxes[mboxId].slotSize)
+    if (msg_size > pMbox->slotSize)
         return -1;
-    // Count slots
-    int slotCount = 0;
-    SlotPtr slot = mailboxes[mboxId].pSlotListHead;
-    while (slot) {
-        slotCount++;
-        slot = slot->pNextSlot;
-    }
-    if (slotCount >= mailboxes[mboxId].slotCount) {
-        // No available slot
-        if (!wait)
-            return -2;
-        // Would block, but single-process test never blocks
-        return -2;
-    }
     // Allocate new slot
     SlotPtr newSlot = (SlotPtr)malloc(sizeof(MailSlot));
     if (!newSlot)
@@ -221,17 +258,59 @@ int mailbox_send(int mboxId, void* pMsg, int msg_size, int wait)
     newSlot->mbox_id = mboxId;
     memcpy(newSlot->message, pMsg, msg_size);
     newSlot->messageSize = msg_size;
+    newSlot->callerPid = callerPid;
+    newSlot->callSequence = callSequence;
+    newSlot->pSendStatus = NULL;
     newSlot->pNextSlot = NULL;
     newSlot->pPrevSlot = NULL;
-    // Insert at end
-    if (!mailboxes[mboxId].pSlotListHead) {
-        mailboxes[mboxId].pSlotListHead = newSlot;
-    } else {
-        SlotPtr last = mailboxes[mboxId].pSlotListHead;
-        while (last->pNextSlot)
-            last = last->pNextSlot;
-        last->pNextSlot = newSlot;
-        newSlot->pPrevSlot = last;
+    // Senders already waiting go first. A zero-slot mailbox only takes a
+    // message when a receiver is waiting for it.
+    if (pMbox->blockedSenderCount == 0 &&
+        (pMbox->type == MB_ZEROSLOT ? pMbox->blockedReceiverCount > 0
+                                    : slot_count(pMbox) < pMbox->slotCount)) {
+        append_slot(&pMbox->pSlotListHead, newSlot);
+        wake_receiver(pMbox);
+        return 0;
+    }
+    // No available slot
+    if (!wait) {
+        free(newSlot);
+        return -2;
+    }
+    // The wait queue is a ring of MAXSLOTS entries, one more would overwrite it
+    if (pMbox->blockedSenderCount == MAXSLOTS) {
+        free(newSlot);
+        return -1;
+    }
+    // Park the message with the other waiting senders, a receiver moves it
+    // into the mailbox when there is room so arrival order is kept
+    int sendStatus = 0;
+    int pid = k_getpid();
+    newSlot->pSendStatus = &sendStatus;
+    append_slot(&pMbox->pWaitingSlotListHead, newSlot);
+    pMbox->blockedSenderQueue[pMbox->blockedSenderTail] = pid;
+    pMbox->blockedSenderTail = (pMbox->blockedSenderTail + 1) % MAXSLOTS;
+    pMbox->blockedSenderCount++;
+    while (sendStatus == 0) {
+        block(BLOCKED_SEND);
+        // Signaled before a receiver took the message, withdraw it
+        if (sendStatus == 0 && signaled()) {
+            if (newSlot->pPrevSlot)
+                newSlot->pPrevSlot->pNextSlot = newSlot->pNextSlot;
+            else
+                pMbox->pWaitingSlotListHead = newSlot->pNextSlot;
+            if (newSlot->pNextSlot)
+                newSlot->pNextSlot->pPrevSlot = newSlot->pPrevSlot;
+            free(newSlot);
+            wait_queue_remove(pMbox->blockedSenderQueue, &pMbox->blockedSenderHead,
+                              &pMbox->blockedSenderTail, &pMbox->blockedSenderCount, pid);
+            return -5;
+        }
+    }
+    if (sendStatus < 0) {
+        // Released by mailbox_free
+        leave_released_mailbox(pMbox);
+        return -5;
     }
     return 0;
 }
@@ -242,35 +321,159 @@ int mailbox_send(int mboxId, void* pMsg, int msg_size, int wait)
              Block the receiving process if no message available.
    Parameters - mailbox id, pointer to buffer for msg, max size of buffer,
                 block flag.
-   Returns - size of received msg (>=0) if successful, -1 if invalid args,
-             -2 if would block (non-blocking mode), -5 if signaled.
+   Returns - size of received msg (>=0) if successful, -1 if invalid args
+             or MAXSLOTS receivers are already blocked on the mailbox, -2 if
+             would block (non-blocking mode), -5 if signaled.
    Side Effects - none.
    ----------------------------------------------------------------------- */
 int mailbox_receive(int mboxId, void* pMsg, int msg_size, int wait)
+{
+    return receive_message(mboxId, pMsg, msg_size, wait, NULL, NULL);
+}
+
+/* Common receive path, hands back the pid and call sequence of a mailbox_call
+ * sender if asked */
+static int receive_message(int mboxId, void* pMsg, int msg_size, int wait, int* pCallerPid, int* pCallSequence)
 {
     // Validate mailbox id
     if (mboxId < 0 || mboxId >= MAXMBOX || mailboxes[mboxId].status != MBSTATUS_INUSE)
         return -1;
-    // Check for available slot
-    SlotPtr slot = mailboxes[mboxId].pSlotListHead;
-    if (!slot) {
+    MailBox* pMbox = &mailboxes[mboxId];
+    // Messages already promised to woken receivers are not available
+    while (slot_count(pMbox) <= pMbox->pendingReceivers) {
+        // A zero-slot sender hands its message over once a receiver shows up
+        if (pMbox->type == MB_ZEROSLOT && pMbox->pWaitingSlotListHead) {
+            deliver_waiting_sender(pMbox);
+            continue;
+        }
         // No message available
         if (!wait)
             return -2;
-        // Would block, but single-process test never blocks
-        return -2;
+        // The wait queue is a ring of MAXSLOTS entries, one more would overwrite it
+        if (pMbox->blockedReceiverCount == MAXSLOTS)
+            return -1;
+        // Queue ourselves and wait for a sender
+        int pid = k_getpid();
+        pMbox->blockedReceiverQueue[pMbox->blockedReceiverTail] = pid;
+        pMbox->blockedReceiverTail = (pMbox->blockedReceiverTail + 1) % MAXSLOTS;
+        pMbox->blockedReceiverCount++;
+        block(BLOCKED_RECEIVE);
+        if (pMbox->releaseBlockedReceivers)
+        {
+            leave_released_mailbox(pMbox);
+            return -5;
+        }
+        // Still queued means a signal woke us, not a sender
+        if (wait_queue_remove(pMbox->blockedReceiverQueue, &pMbox->blockedReceiverHead,
+                              &pMbox->blockedReceiverTail, &pMbox->blockedReceiverCount, pid))
+        {
+            if (signaled())
+                return -5;
+            continue;
+        }
+        // A sender queued a message for us
+        pMbox->pendingReceivers--;
+        break;
     }
+    SlotPtr slot = pMbox->pSlotListHead;
     // Copy message
     int copySize = (slot->messageSize < msg_size) ? slot->messageSize : msg_size;
     memcpy(pMsg, slot->message, copySize);
+    if (pCallerPid)
+        *pCallerPid = slot->callerPid;
+    if (pCallSequence)
+        *pCallSequence = slot->callSequence;
     // Remove slot from list
-    mailboxes[mboxId].pSlotListHead = slot->pNextSlot;
-    if (mailboxes[mboxId].pSlotListHead)
-        mailboxes[mboxId].pSlotListHead->pPrevSlot = NULL;
+    pMbox->pSlotListHead = slot->pNextSlot;
+    if (pMbox->pSlotListHead)
+        pMbox->pSlotListHead->pPrevSlot = NULL;
     free(slot);
+    // A slot opened up, fill it from the longest waiting sender
+    if (pMbox->type != MB_ZEROSLOT)
+        deliver_waiting_sender(pMbox);
     return copySize;
 }
 
+/* Counts the messages queued in a mailbox */
+static int slot_count(MailBox* pMbox)
+{
+    int slotCount = 0;
+    for (SlotPtr slot = pMbox->pSlotListHead; slot; slot = slot->pNextSlot)
+        slotCount++;
+    return slotCount;
+}
+
+/* Adds a slot to the end of a slot list */
+static void append_slot(SlotPtr* pListHead, SlotPtr newSlot)
+{
+    newSlot->pNextSlot = NULL;
+    newSlot->pPrevSlot = NULL;
+    if (!*pListHead) {
+        *pListHead = newSlot;
+    } else {
+        SlotPtr last = *pListHead;
+        while (last->pNextSlot)
+            last = last->pNextSlot;
+        last->pNextSlot = newSlot;
+        newSlot->pPrevSlot = last;
+    }
+}
+
+/* Wakes the longest waiting receiver, if any, and holds a message for it */
+static void wake_receiver(MailBox* pMbox)
+{
+    if (pMbox->blockedReceiverCount > 0) {
+        int pid = pMbox->blockedReceiverQueue[pMbox->blockedReceiverHead];
+        pMbox->blockedReceiverHead = (pMbox->blockedReceiverHead + 1) % MAXSLOTS;
+        pMbox->blockedReceiverCount--;
+        pMbox->pendingReceivers++;
+        unblock(pid);
+    }
+}
+
+/* Called by each waiter mailbox_free released, the last one out lets it finish */
+static void leave_released_mailbox(MailBox* pMbox)
+{
+    if (--pMbox->releasingCount == 0)
+        unblock(pMbox->releaserPid);
+}
+
+/* Moves the longest waiting sender's message into the mailbox and wakes the
+ * sender, and a blocked receiver if there is one */
+static void deliver_waiting_sender(MailBox* pMbox)
+{
+    SlotPtr slot = pMbox->pWaitingSlotListHead;
+    if (!slot)
+        return;
+    pMbox->pWaitingSlotListHead = slot->pNextSlot;
+    if (pMbox->pWaitingSlotListHead)
+        pMbox->pWaitingSlotListHead->pPrevSlot = NULL;
+    *slot->pSendStatus = 1;
+    slot->pSendStatus = NULL;
+    append_slot(&pMbox->pSlotListHead, slot);
+    wake_receiver(pMbox);
+    // The wait queue is in the same order as the parked messages
+    int pid = pMbox->blockedSenderQueue[pMbox->blockedSenderHead];
+    pMbox->blockedSenderHead = (pMbox->blockedSenderHead + 1) % MAXSLOTS;
+    pMbox->blockedSenderCount--;
+    unblock(pid);
+}
+
+/* Removes pid from a wait queue keeping the others in order, returns 1 if it was there */
+static int wait_queue_remove(int* queue, int* pHead, int* pTail, int* pCount, int pid)
+{
+    for (int i = 0; i < *pCount; ++i) {
+        if (queue[(*pHead + i) % MAXSLOTS] == pid) {
+            for (int j = i; j < *pCount - 1; ++j)
+                queue[(*pHead + j) % MAXSLOTS] = queue[(*pHead + j + 1) % MAXSLOTS];
+            *pTail = (*pTail + MAXSLOTS - 1) % MAXSLOTS;
+            (*pCount)--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /* ------------------------------------------------------------------------
    Name - mailbox_free
    Purpose - Frees a previously created mailbox. Any process waiting on
@@ -281,15 +484,212 @@ int mailbox_receive(int mboxId, void* pMsg, int msg_size, int wait)
    ----------------------------------------------------------------------- */
 int mailbox_free(int mboxId)
 {
-    int result = -1;
+    // Validate mailbox id
+    if (mboxId < 0 || mboxId >= MAXMBOX || mailboxes[mboxId].status != MBSTATUS_INUSE)
+        return -1;
+    MailBox* pMbox = &mailboxes[mboxId];
+    // No new sends or receives once the mailbox is being released
+    pMbox->status = MBSTATUS_RELEASED;
+    // Discard undelivered messages, parked senders learn they were released.
+    // A discarded call request will never be answered, so its caller is
+    // released too.
+    int releasedCalls = 0;
+    while (pMbox->pSlotListHead) {
+        SlotPtr slot = pMbox->pSlotListHead;
+        pMbox->pSlotListHead = slot->pNextSlot;
+        CallChannel* pChannel = slot->callerPid ? find_call(slot->callerPid, slot->callSequence) : NULL;
+        if (pChannel) {
+            pChannel->state = pChannel->state == CALL_BLOCKED ? CALL_RELEASING : CALL_RELEASED;
+            releasedCalls++;
+        }
+        free(slot);
+    }
+    while (pMbox->pWaitingSlotListHead) {
+        SlotPtr slot = pMbox->pWaitingSlotListHead;
+        pMbox->pWaitingSlotListHead = slot->pNextSlot;
+        *slot->pSendStatus = -1;
+        free(slot);
+    }
+    // Wake every waiter, each one returns -5. Woken receivers that have not
+    // run yet still have to leave through the release check.
+    pMbox->releaseBlockedSenders = 1;
+    pMbox->releaseBlockedReceivers = 1;
+    pMbox->releasingCount = pMbox->blockedSenderCount + pMbox->blockedReceiverCount +
+                            pMbox->pendingReceivers + releasedCalls;
+    pMbox->releaserPid = k_getpid();
+    for (CallChannel* pChannel = pActiveCalls; pChannel; pChannel = pChannel->pNext) {
+        if (pChannel->mboxId == mboxId && pChannel->state == CALL_RELEASING) {
+            pChannel->state = CALL_RELEASED;
+            unblock(pChannel->pid);
+        }
+    }
+    while (pMbox->blockedSenderCount > 0) {
+        int pid = pMbox->blockedSenderQueue[pMbox->blockedSenderHead];
+        pMbox->blockedSenderHead = (pMbox->blockedSenderHead + 1) % MAXSLOTS;
+        pMbox->blockedSenderCount--;
+        unblock(pid);
+    }
+    while (pMbox->blockedReceiverCount > 0) {
+        int pid = pMbox->blockedReceiverQueue[pMbox->blockedReceiverHead];
+        pMbox->blockedReceiverHead = (pMbox->blockedReceiverHead + 1) % MAXSLOTS;
+        pMbox->blockedReceiverCount--;
+        unblock(pid);
+    }
+    // Keep the mailbox from being reused until all of them have left it,
+    // a signal must not cut this short
+    while (pMbox->releasingCount > 0)
+        block(BLOCKED_RELEASE);
+    pMbox->status = MBSTATUS_EMPTY;
+    return signaled() ? -5 : 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - mailbox_call
+   Purpose - Sends a request to a server's mailbox and waits for the reply in
+             one call. The caller blocks once; a server waiting on the mailbox
+             is woken by the send and its mailbox_reply copies straight into
+             pReply. The reply channel lives on the caller's stack for the
+             duration of the call and is tagged with a sequence number, so a
+             reply to an abandoned call is never taken for a later one.
+   Parameters - server mailbox id, request, request size, reply buffer,
+                size of reply buffer.
+   Returns - size of the reply (>=0) if successful, -1 if invalid args or the
+             server mailbox's wait queue is full,
+             -5 if signaled or the mailbox was freed while waiting.
+   ----------------------------------------------------------------------- */
+int mailbox_call(int mboxId, void* pRequest, int requestSize, void* pReply, int replySize)
+{
+    CallChannel channel;
+    int result;
+
+    if (pReply == NULL || replySize < 0)
+        return -1;
+
+    channel.pid = k_getpid();
+    channel.mboxId = mboxId;
+    channel.pReplyBuffer = pReply;
+    channel.replyBufferSize = replySize;
+    channel.replySize = 0;
+    channel.state = CALL_PENDING;
+
+    disableInterrupts();
+    // Sequence 0 marks a plain send, skip it when the counter wraps
+    if (++nextCallSequence <= 0)
+        nextCallSequence = 1;
+    channel.sequence = nextCallSequence;
+    channel.pNext = pActiveCalls;
+    pActiveCalls = &channel;
+    enableInterrupts();
+
+    result = send_message(mboxId, pRequest, requestSize, TRUE, channel.pid, channel.sequence);
+    if (result >= 0)
+    {
+        // The server may already have replied if the send switched to it
+        disableInterrupts();
+        if (channel.state == CALL_PENDING)
+        {
+            channel.state = CALL_BLOCKED;
+            block(BLOCKED_CALL);
+        }
+        enableInterrupts();
+
+        if (channel.state == CALL_DONE)
+        {
+            result = channel.replySize;
+        }
+        else
+        {
+            // Signaled or released. A late reply finds no channel and is dropped.
+            if (channel.state == CALL_RELEASING || channel.state == CALL_RELEASED)
+                leave_released_mailbox(&mailboxes[mboxId]);
+            result = -5;
+        }
+    }
 
+    disableInterrupts();
+    unlink_call(&channel);
+    enableInterrupts();
     return result;
 }
 
+/* ------------------------------------------------------------------------
+   Name - mailbox_receive_call
+   Purpose - Receives a request like mailbox_receive and also returns the
+             pid and call sequence to pass to mailbox_reply.
+   Parameters - mailbox id, buffer for msg, max size of buffer, caller pid
+                output (0 if the message came from mailbox_send), call
+                sequence output.
+   Returns - size of received msg (>=0) if successful, -1 if invalid args,
+             -5 if signaled.
+   ----------------------------------------------------------------------- */
+int mailbox_receive_call(int mboxId, void* pMsg, int msg_size, int* pCallerPid, int* pCallSequence)
+{
+    if (pCallerPid == NULL || pCallSequence == NULL)
+        return -1;
+    return receive_message(mboxId, pMsg, msg_size, TRUE, pCallerPid, pCallSequence);
+}
+
+/* ------------------------------------------------------------------------
+   Name - mailbox_reply
+   Purpose - Completes a mailbox_call: copies the reply into the caller's
+             buffer and wakes the caller. Never blocks. A reply whose
+             sequence does not match the caller's current call is dropped.
+   Parameters - caller pid and call sequence from mailbox_receive_call,
+                reply, reply size.
+   Returns - zero if successful, -1 if that call is no longer waiting.
+   ----------------------------------------------------------------------- */
+int mailbox_reply(int callerPid, int callSequence, void* pReply, int replySize)
+{
+    if (callerPid <= 0 || callSequence <= 0 || replySize < 0)
+        return -1;
+
+    disableInterrupts();
+    CallChannel* pChannel = find_call(callerPid, callSequence);
+    if (pChannel == NULL ||
+        (pChannel->state != CALL_PENDING && pChannel->state != CALL_BLOCKED))
+    {
+        enableInterrupts();
+        return -1;
+    }
+
+    int copySize = (replySize < pChannel->replyBufferSize) ? replySize : pChannel->replyBufferSize;
+    memcpy(pChannel->pReplyBuffer, pReply, copySize);
+    pChannel->replySize = copySize;
+
+    int wasBlocked = pChannel->state == CALL_BLOCKED;
+    pChannel->state = CALL_DONE;
+    if (wasBlocked)
+        unblock(callerPid);
+    enableInterrupts();
+    return 0;
+}
+
+/* Finds the call in progress with this pid and sequence, NULL if there is none */
+static CallChannel* find_call(int pid, int sequence)
+{
+    for (CallChannel* pChannel = pActiveCalls; pChannel; pChannel = pChannel->pNext)
+    {
+        if (pChannel->pid == pid && pChannel->sequence == sequence)
+            return pChannel;
+    }
+    return NULL;
+}
+
+/* Takes a finished call off the list of calls in progress */
+static void unlink_call(CallChannel* pChannel)
+{
+    CallChannel** ppLink = &pActiveCalls;
+    while (*ppLink && *ppLink != pChannel)
+        ppLink = &(*ppLink)->pNext;
+    if (*ppLink)
+        *ppLink = pChannel->pNext;
+}
+
 /* ------------------------------------------------------------------------
    Name - wait_device
    Purpose - Waits for a device interrupt by blocking on the device's
              mailbox. Returns the device status via the status pointer.
+             Terminals are not supported, use term_read/term_write.
    Parameters - device name string, pointer to status output.
    Returns - 0 if successful, -1 if invalid parameter, -5 if signaled.
    ----------------------------------------------------------------------- */
@@ -299,6 +699,15 @@ int wait_device(char* deviceName, int* status)
     uint32_t deviceHandle = -1;
     checkKernelMode("waitdevice");
 
+    /* Terminal interrupts feed the term_read/term_write rings and their
+     * mailbox only carries wakeups, so there is no status to hand back. */
+    int index = device_index(deviceName);
+    if (index >= 0 && devices[index].deviceType == DEVICE_TERMINAL)
+    {
+        console_output(FALSE, "wait_device(): %s is driven by term_read/term_write.\n", deviceName);
+        return -1;
+    }
+
     enableInterrupts();
 
     if (strcmp(deviceName, "clock") == 0)
@@ -336,6 +745,507 @@ int wait_device(char* deviceName, int* status)
     return result;
 }
 
+/* ------------------------------------------------------------------------
+   Name - term_read
+   Purpose - Reads buffered input from a terminal. Blocks until at least one
+             byte (or, in line mode, a full line) has been received, then
+             returns everything buffered that fits in one call.
+   Parameters - terminal unit, buffer, size of buffer, line mode flag.
+   Returns - number of bytes read, -1 if invalid args, -5 if signaled.
+   ----------------------------------------------------------------------- */
+int term_read(int unit, void* pBuffer, int bufferSize, int lineMode)
+{
+    int deviceIndex = FIRST_TERMINAL_INDEX + unit;
+    int status;
+
+    checkKernelMode("term_read");
+    if (unit < 0 || unit >= TERMINAL_COUNT || pBuffer == NULL || bufferSize <= 0)
+        return -1;
+
+    TermRing* pRing = &terminals[unit].receiveRing;
+    unsigned char* pOut = (unsigned char*)pBuffer;
+
+    while (1)
+    {
+        disableInterrupts();
+        // A full ring counts as a line so a long line can't stall the reader
+        if (pRing->count > 0 && (!lineMode || pRing->lineCount > 0 || pRing->count == TERM_RING_SIZE))
+        {
+            int bytesRead = 0;
+            unsigned char ch;
+            while (bytesRead < bufferSize && term_ring_get(pRing, &ch))
+            {
+                pOut[bytesRead++] = ch;
+                if (lineMode && ch == '\n')
+                    break;
+            }
+            enableInterrupts();
+            return bytesRead;
+        }
+        enableInterrupts();
+
+        // Wait for the interrupt handler to post a wakeup; a stale one just loops again
+        waitingOnDevice++;
+        int result = mailbox_receive(devices[deviceIndex].deviceMbox, &status, sizeof(int), TRUE);
+        waitingOnDevice--;
+        if (result == -5 || signaled())
+            return -5;
+    }
+}
+
+/* ------------------------------------------------------------------------
+   Name - term_write
+   Purpose - Queues bytes on a terminal's transmit ring and starts the
+             transmitter if it is idle. The I/O interrupt handler sends the
+             rest. Blocks only while the ring is full.
+   Parameters - terminal unit, data to write, number of bytes.
+   Returns - number of bytes queued, -1 if invalid args, -5 if signaled.
+   ----------------------------------------------------------------------- */
+int term_write(int unit, void* pBuffer, int size)
+{
+    int status;
+    int bytesQueued = 0;
+
+    checkKernelMode("term_write");
+    if (unit < 0 || unit >= TERMINAL_COUNT || pBuffer == NULL || size < 0)
+        return -1;
+
+    TerminalData* pTerm = &terminals[unit];
+    unsigned char* pIn = (unsigned char*)pBuffer;
+
+    while (bytesQueued < size)
+    {
+        disableInterrupts();
+        while (bytesQueued < size && pTerm->transmitRing.count < TERM_RING_SIZE)
+            term_ring_put(&pTerm->transmitRing, pIn[bytesQueued++]);
+
+        // Prime the transmitter, the interrupt handler keeps it going from here
+        unsigned char ch;
+        if (!pTerm->transmitBusy && term_ring_get(&pTerm->transmitRing, &ch))
+        {
+            pTerm->transmitBusy = 1;
+            TERM_TRANSMIT(devices[FIRST_TERMINAL_INDEX + unit].deviceName, ch);
+        }
+        enableInterrupts();
+
+        if (bytesQueued < size)
+        {
+            waitingOnDevice++;
+            int result = mailbox_receive(pTerm->transmitMbox, &status, sizeof(int), TRUE);
+            waitingOnDevice--;
+            if (result == -5 || signaled())
+                return -5;
+        }
+    }
+    return bytesQueued;
+}
+
+/* ------------------------------------------------------------------------
+   Name - disk_service_start
+   Purpose - Starts the driver process that serves asynchronous requests for
+             a disk. The caller is the driver's parent and must k_wait for
+             it after disk_service_stop.
+   Parameters - disk unit, scheduling policy (DISK_SCHED_FIFO/CLOOK).
+   Returns - the request mailbox id, -1 if invalid args or no resources.
+   ----------------------------------------------------------------------- */
+int disk_service_start(int unit, int scheduling)
+{
+    char driverName[16];
+
+    checkKernelMode("disk_service_start");
+    if (unit < 0 || unit >= DISK_COUNT || diskServices[unit].driverPid > 0)
+        return -1;
+    if (scheduling != DISK_SCHED_FIFO && scheduling != DISK_SCHED_CLOOK)
+        return -1;
+
+    // A completion nobody collected must not pass for the new driver's first transfer
+    int status;
+    while (mailbox_receive(devices[unit].deviceMbox, &status, sizeof(int), FALSE) >= 0)
+        ;
+
+    DiskService* pService = &diskServices[unit];
+    memset(pService, 0, sizeof(DiskService));
+    pService->scheduling = scheduling;
+    pService->requestMbox = mailbox_create(DISK_QUEUE_SIZE, sizeof(DiskRequest));
+    if (pService->requestMbox < 0)
+        return -1;
+
+    snprintf(driverName, sizeof(driverName), "DiskDriver%d", unit);
+    pService->driverPid = k_spawn(driverName, disk_driver, (void*)(intptr_t)unit, THREADS_MIN_STACK_SIZE, 1);
+    if (pService->driverPid < 0)
+    {
+        pService->driverPid = 0;
+        return -1;
+    }
+    return pService->requestMbox;
+}
+
+/* ------------------------------------------------------------------------
+   Name - disk_service_stop
+   Purpose - Asks a disk's driver to finish its queued requests and exit.
+             New requests are refused from here on, and requests that reach
+             the driver after the shutdown are failed with status -1.
+             Waits until the driver has drained its queue.
+   Parameters - disk unit.
+   Returns - 0 if successful, -1 if the service is not running or already
+             stopping, -5 if signaled.
+   ----------------------------------------------------------------------- */
+int disk_service_stop(int unit)
+{
+    DiskRequest request;
+    DiskReply reply;
+    int result;
+
+    if (unit < 0 || unit >= DISK_COUNT || diskServices[unit].driverPid <= 0 || diskServices[unit].stopping)
+        return -1;
+
+    memset(&request, 0, sizeof(request));
+    request.operation = DISK_REQUEST_SHUTDOWN;
+    request.replyMbox = mailbox_create(1, sizeof(DiskReply));
+    if (request.replyMbox < 0)
+        return -1;
+
+    diskServices[unit].stopping = TRUE;
+    result = mailbox_send(diskServices[unit].requestMbox, &request, sizeof(DiskRequest), TRUE);
+    if (result == 0)
+        result = disk_request_wait(request.replyMbox, &reply) < 0 ? -5 : 0;
+    mailbox_free(request.replyMbox);
+    diskServices[unit].driverPid = 0;
+    return result;
+}
+
+/* ------------------------------------------------------------------------
+   Name - disk_request_async
+   Purpose - Queues a read or write with a disk's driver and returns without
+             waiting. The completion is sent to pRequest->replyMbox without
+             blocking, so that mailbox needs a free slot for each request the
+             caller has in flight; a completion that does not fit is dropped
+             and counted in repliesDropped.
+   Parameters - disk unit, request to queue.
+   Returns - 0 if queued, -1 if invalid args or the service is stopping,
+             -5 if signaled.
+   ----------------------------------------------------------------------- */
+int disk_request_async(int unit, DiskRequest* pRequest)
+{
+    if (unit < 0 || unit >= DISK_COUNT || pRequest == NULL ||
+        diskServices[unit].driverPid <= 0 || diskServices[unit].stopping)
+        return -1;
+    if ((pRequest->operation != DISK_REQUEST_READ && pRequest->operation != DISK_REQUEST_WRITE) ||
+        pRequest->track < 0 || pRequest->track >= DISK_TRACK_COUNT ||
+        pRequest->firstSector < 0 || pRequest->sectorCount <= 0 ||
+        pRequest->firstSector + pRequest->sectorCount > DISK_SECTORS_PER_TRACK ||
+        pRequest->pBuffer == NULL)
+        return -1;
+
+    return mailbox_send(diskServices[unit].requestMbox, pRequest, sizeof(DiskRequest), TRUE);
+}
+
+/* ------------------------------------------------------------------------
+   Name - disk_request_wait
+   Purpose - Waits for the next disk completion on a reply mailbox.
+   Parameters - reply mailbox id, reply output.
+   Returns - 0 if successful, -1 if invalid args, -5 if signaled.
+   ----------------------------------------------------------------------- */
+int disk_request_wait(int replyMbox, DiskReply* pReply)
+{
+    int result = mailbox_receive(replyMbox, pReply, sizeof(DiskReply), TRUE);
+    return result < 0 ? result : 0;
+}
+
+/* Returns a disk's service statistics, NULL for an invalid unit */
+DiskService* disk_service_stats(int unit)
+{
+    if (unit < 0 || unit >= DISK_COUNT)
+        return NULL;
+    return &diskServices[unit];
+}
+
+/* ------------------------------------------------------------------------
+   Name - disk_driver
+   Purpose - Driver process for one disk. Drains the request mailbox into
+             its queue, picks the next request by the scheduling policy,
+             merges requests for the following sectors of the same track
+             into one transfer, and replies to each requester. If it is
+             signaled, it finishes the transfer in progress, fails the rest
+             with status -1 and exits.
+   Parameters - disk unit.
+   Returns - 0 when shut down, -5 if signaled.
+   ----------------------------------------------------------------------- */
+static int disk_driver(void* arg)
+{
+    int unit = (int)(intptr_t)arg;
+    DiskService* pService = &diskServices[unit];
+    int requestMbox = pService->requestMbox;
+    DiskRequest request;
+    int shutdownMbox = -1;
+    int signaledOut = FALSE;
+    int status;
+
+    while (!signaledOut && (shutdownMbox < 0 || pService->pendingCount > 0))
+    {
+        // Block only when there is nothing to do, then take everything that is waiting
+        int wait = pService->pendingCount == 0;
+        while (shutdownMbox < 0 && pService->pendingCount < DISK_QUEUE_SIZE)
+        {
+            if (mailbox_receive(requestMbox, &request, sizeof(DiskRequest), wait) < 0)
+            {
+                // A blocking receive only fails if the driver was signaled
+                signaledOut = wait;
+                break;
+            }
+            wait = FALSE;
+            if (request.operation == DISK_REQUEST_SHUTDOWN)
+                shutdownMbox = request.replyMbox;
+            else
+                disk_queue_insert(pService, &request);
+        }
+        if (pService->pendingCount == 0)
+            continue;
+
+        // Collect the run of requests that continue where the first one ends
+        int first = disk_next_request(pService);
+        DiskRequest* pFirst = &pService->pending[first];
+        int last = first;
+        int sectorCount = pFirst->sectorCount;
+        if (pService->scheduling == DISK_SCHED_CLOOK)
+        {
+            while (last + 1 < pService->pendingCount)
+            {
+                DiskRequest* pNext = &pService->pending[last + 1];
+                if (pNext->operation != pFirst->operation || pNext->track != pFirst->track ||
+                    pNext->firstSector != pFirst->firstSector + sectorCount ||
+                    sectorCount + pNext->sectorCount > DISK_MAX_MERGE)
+                    break;
+                sectorCount += pNext->sectorCount;
+                last++;
+            }
+        }
+
+        void* pTransfer = pFirst->pBuffer;
+        if (last != first)
+        {
+            pTransfer = pService->mergeBuffer;
+            if (pFirst->operation == DISK_REQUEST_WRITE)
+            {
+                for (int i = first, offset = 0; i <= last; offset += pService->pending[i].sectorCount, ++i)
+                    memcpy(pService->mergeBuffer + offset * DISK_SECTOR_SIZE, pService->pending[i].pBuffer,
+                           pService->pending[i].sectorCount * DISK_SECTOR_SIZE);
+            }
+        }
+
+        pService->tracksMoved += abs(pFirst->track - pService->currentTrack);
+        pService->transfers++;
+        if (DISK_START_TRANSFER(devices[unit].deviceName, pFirst->operation, pFirst->track,
+                                pFirst->firstSector, sectorCount, pTransfer) < 0)
+        {
+            // The device refused the transfer, no interrupt will follow
+            status = -1;
+        }
+        else
+        {
+            // A signal does not stop the device, so wait for the completion
+            // rather than leave it in the device mailbox for the next driver
+            int result;
+            waitingOnDevice++;
+            while ((result = mailbox_receive(devices[unit].deviceMbox, &status, sizeof(int), TRUE)) == -5)
+                ;
+            waitingOnDevice--;
+            if (result < 0)
+                status = -1;
+            // The completion may have beaten the signal to the wakeup, the
+            // driver still has to leave
+            if (signaled())
+                signaledOut = TRUE;
+        }
+
+        pService->currentTrack = pFirst->track;
+        pService->currentSector = pFirst->firstSector + sectorCount;
+
+        for (int i = first, offset = 0; i <= last; offset += pService->pending[i].sectorCount, ++i)
+        {
+            DiskRequest* pDone = &pService->pending[i];
+            if (last != first && pDone->operation == DISK_REQUEST_READ)
+                memcpy(pDone->pBuffer, pService->mergeBuffer + offset * DISK_SECTOR_SIZE,
+                       pDone->sectorCount * DISK_SECTOR_SIZE);
+            disk_reply(pService, pDone->replyMbox, pDone->requestId, status);
+            pService->requestsServed++;
+        }
+
+        // Close the gap left by the served run
+        memmove(&pService->pending[first], &pService->pending[last + 1],
+                (pService->pendingCount - last - 1) * sizeof(DiskRequest));
+        pService->pendingCount -= last - first + 1;
+    }
+
+    // Fail everything not served, including requests sent after the shutdown
+    pService->stopping = TRUE;
+    for (int i = 0; i < pService->pendingCount; ++i)
+        disk_reply(pService, pService->pending[i].replyMbox, pService->pending[i].requestId, -1);
+    pService->pendingCount = 0;
+    while (mailbox_receive(requestMbox, &request, sizeof(DiskRequest), FALSE) >= 0)
+    {
+        if (request.operation == DISK_REQUEST_SHUTDOWN)
+        {
+            if (shutdownMbox < 0)
+                shutdownMbox = request.replyMbox;
+            continue;
+        }
+        disk_reply(pService, request.replyMbox, request.requestId, -1);
+    }
+
+    if (shutdownMbox >= 0)
+        disk_reply(pService, shutdownMbox, 0, 0);
+    mailbox_free(requestMbox);
+    if (signaledOut && shutdownMbox < 0)
+    {
+        // Nobody is stopping the service, so let it be started again
+        pService->driverPid = 0;
+    }
+    k_exit(signaledOut ? -5 : 0);
+    return signaledOut ? -5 : 0;
+}
+
+/* Sends a completion without blocking, so a requester that is not collecting
+ * its replies cannot hold up the disk for everyone else */
+static void disk_reply(DiskService* pService, int replyMbox, int requestId, int status)
+{
+    DiskReply reply;
+
+    reply.requestId = requestId;
+    reply.status = status;
+    if (mailbox_send(replyMbox, &reply, sizeof(DiskReply), FALSE) < 0)
+        pService->repliesDropped++;
+}
+
+/* Adds a request to a disk's queue, kept in arrival order for FIFO and
+ * sorted by track and sector for C-LOOK */
+static void disk_queue_insert(DiskService* pService, DiskRequest* pRequest)
+{
+    int position = pService->pendingCount;
+
+    if (pService->scheduling == DISK_SCHED_CLOOK)
+    {
+        while (position > 0)
+        {
+            DiskRequest* pPrev = &pService->pending[position - 1];
+            if (pPrev->track < pRequest->track ||
+                (pPrev->track == pRequest->track && pPrev->firstSector <= pRequest->firstSector))
+                break;
+            pService->pending[position] = *pPrev;
+            position--;
+        }
+    }
+    pService->pending[position] = *pRequest;
+    pService->pendingCount++;
+}
+
+/* Picks the index of the next request to serve. C-LOOK sweeps toward higher
+ * tracks from the head position and jumps back to the lowest request at the end */
+static int disk_next_request(DiskService* pService)
+{
+    if (pService->scheduling == DISK_SCHED_CLOOK)
+    {
+        for (int i = 0; i < pService->pendingCount; ++i)
+        {
+            DiskRequest* pRequest = &pService->pending[i];
+            if (pRequest->track > pService->currentTrack ||
+                (pRequest->track == pService->currentTrack && pRequest->firstSector >= pService->currentSector))
+                return i;
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+   Name - io_handler
+   Purpose - Handles I/O interrupts. Terminal bytes go through the terminal's
+             rings and only a wakeup is posted to the mailbox, so nothing is
+             lost while a reader is busy. Terminals are therefore owned by
+             term_read/term_write and wait_device refuses them. Other
+             devices post their status for wait_device.
+   Parameters - device name, command, device status, unused.
+   ----------------------------------------------------------------------- */
+static void io_handler(char deviceId[32], uint8_t command, uint32_t status, void* pArgs)
+{
+    int deviceIndex = device_index(deviceId);
+    int wakeup = (int)status;
+
+    if (deviceIndex < 0)
+    {
+        console_output(FALSE, "io_handler(): Unknown device %s.\n", deviceId);
+        return;
+    }
+
+    if (devices[deviceIndex].deviceType == DEVICE_TERMINAL)
+    {
+        TerminalData* pTerm = &terminals[deviceIndex - FIRST_TERMINAL_INDEX];
+
+        if (TERM_STATUS_RECV_READY(status))
+        {
+            term_ring_put(&pTerm->receiveRing, TERM_STATUS_CHAR(status));
+            // Conditional send, if a wakeup is already pending the reader gets this byte too
+            mailbox_send(devices[deviceIndex].deviceMbox, &wakeup, sizeof(int), FALSE);
+        }
+        if (TERM_STATUS_XMIT_READY(status) && pTerm->transmitBusy)
+        {
+            unsigned char ch;
+            if (term_ring_get(&pTerm->transmitRing, &ch))
+            {
+                TERM_TRANSMIT(devices[deviceIndex].deviceName, ch);
+            }
+            else
+            {
+                pTerm->transmitBusy = 0;
+            }
+            mailbox_send(pTerm->transmitMbox, &wakeup, sizeof(int), FALSE);
+        }
+    }
+    else
+    {
+        mailbox_send(devices[deviceIndex].deviceMbox, &wakeup, sizeof(int), FALSE);
+    }
+}
+
+/* Looks up a device's index in the devices table by name, -1 if not found */
+static int device_index(const char* deviceName)
+{
+    for (int i = 0; i < THREADS_MAX_DEVICES; ++i)
+    {
+        if (i != THREADS_CLOCK_DEVICE_ID && strcmp(devices[i].deviceName, deviceName) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Adds a byte to a terminal ring, returns 0 and counts it as dropped if full */
+static int term_ring_put(TermRing* pRing, unsigned char ch)
+{
+    if (pRing->count == TERM_RING_SIZE)
+    {
+        pRing->dropped++;
+        return 0;
+    }
+    pRing->buffer[pRing->tail] = ch;
+    pRing->tail = (pRing->tail + 1) % TERM_RING_SIZE;
+    pRing->count++;
+    if (ch == '\n')
+        pRing->lineCount++;
+    return 1;
+}
+
+/* Removes the oldest byte from a terminal ring, returns 0 if empty */
+static int term_ring_get(TermRing* pRing, unsigned char* pCh)
+{
+    if (pRing->count == 0)
+        return 0;
+    *pCh = pRing->buffer[pRing->head];
+    pRing->head = (pRing->head + 1) % TERM_RING_SIZE;
+    pRing->count--;
+    if (*pCh == '\n')
+        pRing->lineCount--;
+    return 1;
+}
+
 
 int check_io_messaging(void)
 {
@@ -349,14 +1259,17 @@ int check_io_messaging(void)
 static void InitializeHandlers()
 {
     handlers = get_interrupt_handlers();
+    handlers[THREADS_IO_INTERRUPT] = io_handler;
+
+    for (int i = 0; i < THREADS_MAX_SYSCALLS; ++i)
+    {
+        systemCallVector[i] = nullsys;
+    }
 
-    /* TODO: Register interrupt handlers in the handlers array.
-     * Use the interrupt indices defined in THREADSLib.h:
+    /* TODO: Register the remaining interrupt handlers:
      *   handlers[THREADS_TIMER_INTERRUPT]   = your_clock_handler;
-     *   handlers[THREADS_IO_INTERRUPT]      = your_io_handler;
      *   handlers[THREADS_SYS_CALL_INTERRUPT] = your_syscall_handler;
-     *
-     * Also initialize the system call vector (systemCallVector).
+     * and fill in systemCallVector entries for the real system calls.
      */
 
 }